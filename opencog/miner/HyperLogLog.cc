@@ -0,0 +1,91 @@
+/*
+ * HyperLogLog.cc
+ *
+ * Copyright (C) 2020 SingularityNET Foundation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License v3 as
+ * published by the Free Software Foundation and including the exceptions
+ * at http://opencog.org/wiki/Licenses
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program; if not, write to:
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "HyperLogLog.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace opencog
+{
+
+HyperLogLog::HyperLogLog(unsigned precision)
+	: _precision(std::min(18U, std::max(4U, precision))),
+	  _registers(1UL << _precision, 0) {}
+
+unsigned HyperLogLog::precision_for_error(double error)
+{
+	unsigned p = 4;
+	while (p < 18 and error < 1.04 / std::sqrt((double)(1UL << p)))
+		p++;
+	return p;
+}
+
+void HyperLogLog::insert(size_t hash)
+{
+	uint64_t h = mix(hash);
+
+	// The first bits select the register, the position of the first
+	// 1 in the remaining bits is the observed rank
+	size_t idx = h >> (64 - _precision);
+	uint64_t w = h << _precision;
+	uint8_t rank = w ? __builtin_clzll(w) + 1 : 64 - _precision + 1;
+	_registers[idx] = std::max(_registers[idx], rank);
+}
+
+double HyperLogLog::estimate() const
+{
+	double m = _registers.size();
+	double alpha = m <= 16 ? 0.673 : m <= 32 ? 0.697 : m <= 64 ? 0.709
+		: 0.7213 / (1.0 + 1.079 / m);
+
+	double sum = 0.0;
+	unsigned zeros = 0;
+	for (uint8_t r : _registers) {
+		sum += std::ldexp(1.0, -r);
+		if (r == 0)
+			zeros++;
+	}
+	double e = alpha * m * m / sum;
+
+	// Small range correction, using linear counting
+	if (e <= 2.5 * m and 0 < zeros)
+		e = m * std::log(m / zeros);
+	return e;
+}
+
+void HyperLogLog::clear()
+{
+	std::fill(_registers.begin(), _registers.end(), 0);
+}
+
+uint64_t HyperLogLog::mix(uint64_t h)
+{
+	// Finalizer of splitmix64
+	h ^= h >> 30;
+	h *= 0xbf58476d1ce4e5b9ULL;
+	h ^= h >> 27;
+	h *= 0x94d049bb133111ebULL;
+	h ^= h >> 31;
+	return h;
+}
+
+} // ~namespace opencog
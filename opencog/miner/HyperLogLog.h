@@ -0,0 +1,84 @@
+/*
+ * HyperLogLog.h
+ *
+ * Copyright (C) 2020 SingularityNET Foundation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License v3 as
+ * published by the Free Software Foundation and including the exceptions
+ * at http://opencog.org/wiki/Licenses
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program; if not, write to:
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef OPENCOG_MINER_HYPERLOGLOG_H_
+#define OPENCOG_MINER_HYPERLOGLOG_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace opencog
+{
+
+/**
+ * HyperLogLog sketch, to estimate the number of distinct elements of
+ * a stream in constant memory, see
+ *
+ * Flajolet et al., HyperLogLog: the analysis of a near-optimal
+ * cardinality estimation algorithm, 2007.
+ *
+ * Elements are inserted by hash (for atoms, their content hash). The
+ * sketch uses 2^precision registers of one byte each, and has a
+ * relative standard error of about 1.04/sqrt(2^precision).
+ */
+class HyperLogLog
+{
+public:
+	/**
+	 * CTor. precision is clamped to [4, 18].
+	 */
+	HyperLogLog(unsigned precision=14);
+
+	/**
+	 * Return the smallest precision such that the relative standard
+	 * error is below error.
+	 */
+	static unsigned precision_for_error(double error);
+
+	/**
+	 * Add the element with the given hash.
+	 */
+	void insert(size_t hash);
+
+	/**
+	 * Return the estimated number of distinct inserted elements.
+	 */
+	double estimate() const;
+
+	/**
+	 * Reset the sketch to its empty state.
+	 */
+	void clear();
+
+private:
+	unsigned _precision;
+	std::vector<uint8_t> _registers;
+
+	/**
+	 * Scramble the bits of a hash, as atom hashes are not uniformly
+	 * distributed.
+	 */
+	static uint64_t mix(uint64_t h);
+};
+
+} // ~namespace opencog
+
+#endif /* OPENCOG_MINER_HYPERLOGLOG_H_ */
@@ -0,0 +1,105 @@
+/*
+ * InfrequentCache.cc
+ *
+ * Copyright (C) 2020 SingularityNET Foundation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License v3 as
+ * published by the Free Software Foundation and including the exceptions
+ * at http://opencog.org/wiki/Licenses
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program; if not, write to:
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "InfrequentCache.h"
+#include "MinerUtils.h"
+
+namespace opencog
+{
+
+InfrequentCache::InfrequentCache(size_t n_bits, unsigned n_hashes)
+	: _bloom(n_bits, false), _n_hashes(n_hashes) {}
+
+void InfrequentCache::insert(const Handle& pattern)
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	for (size_t i : bloom_indices(pattern))
+		_bloom[i] = true;
+	_patterns.insert(pattern);
+}
+
+bool InfrequentCache::contains(const Handle& pattern) const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return contains_nolock(pattern);
+}
+
+bool InfrequentCache::is_known_infrequent(const Handle& pattern) const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	if (_patterns.empty())
+		return false;
+	if (contains_nolock(pattern))
+		return true;
+
+	// Look for recorded subpatterns with one clause less and the same
+	// variables.
+	HandleSeq clauses = MinerUtils::get_clauses(pattern);
+	if (clauses.size() < 2)
+		return false;
+	Handle vardecl = MinerUtils::get_vardecl(pattern);
+	size_t nvars = MinerUtils::get_variables(pattern).size();
+	for (size_t i = 0; i < clauses.size(); i++) {
+		HandleSeq subclauses(clauses);
+		subclauses.erase(subclauses.begin() + i);
+		Handle subpat =
+			MinerUtils::mk_pattern_filtering_vardecl(vardecl, subclauses);
+		if (subpat and MinerUtils::get_variables(subpat).size() == nvars
+		    and contains_nolock(subpat))
+			return true;
+	}
+	return false;
+}
+
+void InfrequentCache::clear()
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	_bloom.assign(_bloom.size(), false);
+	_patterns.clear();
+}
+
+size_t InfrequentCache::size() const
+{
+	std::lock_guard<std::mutex> lock(_mutex);
+	return _patterns.size();
+}
+
+std::vector<size_t> InfrequentCache::bloom_indices(const Handle& pattern) const
+{
+	// Double hashing, derived from the pattern hash, which is
+	// invariant under alpha-conversion.
+	size_t h1 = pattern->get_hash();
+	size_t h2 = (h1 >> 17) | (h1 << 47) | 1;
+	std::vector<size_t> indices;
+	for (unsigned k = 0; k < _n_hashes; k++)
+		indices.push_back((h1 + k * h2) % _bloom.size());
+	return indices;
+}
+
+bool InfrequentCache::contains_nolock(const Handle& pattern) const
+{
+	for (size_t i : bloom_indices(pattern))
+		if (not _bloom[i])
+			return false;
+	return _patterns.find(pattern) != _patterns.end();
+}
+
+} // namespace opencog
@@ -0,0 +1,124 @@
+/*
+ * InfrequentCache.h
+ *
+ * Copyright (C) 2020 SingularityNET Foundation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License v3 as
+ * published by the Free Software Foundation and including the exceptions
+ * at http://opencog.org/wiki/Licenses
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program; if not, write to:
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef OPENCOG_MINER_INFREQUENT_CACHE_H_
+#define OPENCOG_MINER_INFREQUENT_CACHE_H_
+
+#include <mutex>
+#include <vector>
+
+#include <opencog/atoms/base/Handle.h>
+
+namespace opencog
+{
+
+/**
+ * Cache of patterns known not to reach the minimum support, for a
+ * given db and minimum support. Since support is anti-monotonic,
+ * such patterns can be used to reject candidates before running the
+ * pattern matcher on them.
+ *
+ * Patterns are stored in an exact set (alpha-equivalent patterns
+ * being equal), preceded by a Bloom filter over their hashes to
+ * quickly dismiss patterns that are not in the cache.
+ *
+ * The cache is thread safe.
+ */
+class InfrequentCache
+{
+public:
+	/**
+	 * CTor. n_bits is the size of the Bloom filter and n_hashes the
+	 * number of hash functions used by it.
+	 */
+	InfrequentCache(size_t n_bits=1 << 20, unsigned n_hashes=3);
+
+	/**
+	 * Record that pattern does not have enough support.
+	 */
+	void insert(const Handle& pattern);
+
+	/**
+	 * Return true iff pattern has been recorded as infrequent.
+	 */
+	bool contains(const Handle& pattern) const;
+
+	/**
+	 * Return true iff pattern is known to be infrequent, that is
+	 * either it has been recorded as such, or one of its subpatterns
+	 * obtained by removing one clause, while keeping all variables,
+	 * has been. Keeping all variables is important because adding a
+	 * clause introducing new variables may increase the support.
+	 *
+	 * For instance if
+	 *
+	 * (Lambda
+	 *   (VariableSet X Y)
+	 *   (Present
+	 *     (Inheritance X Y)
+	 *     (Inheritance Y X)))
+	 *
+	 * has been recorded, then
+	 *
+	 * (Lambda
+	 *   (VariableSet X Y)
+	 *   (Present
+	 *     (Inheritance X Y)
+	 *     (Inheritance Y X)
+	 *     (Inheritance X (Concept "A"))))
+	 *
+	 * is known to be infrequent.
+	 */
+	bool is_known_infrequent(const Handle& pattern) const;
+
+	/**
+	 * Remove all recorded patterns.
+	 */
+	void clear();
+
+	/**
+	 * Return the number of recorded patterns.
+	 */
+	size_t size() const;
+
+private:
+	// Bloom filter over the hashes of recorded patterns
+	std::vector<bool> _bloom;
+	unsigned _n_hashes;
+
+	// Recorded patterns
+	HandleSet _patterns;
+
+	mutable std::mutex _mutex;
+
+	/**
+	 * Return the Bloom filter bit indices of pattern
+	 */
+	std::vector<size_t> bloom_indices(const Handle& pattern) const;
+
+	/**
+	 * Like contains but assumes the mutex is already locked
+	 */
+	bool contains_nolock(const Handle& pattern) const;
+};
+
+} // ~namespace opencog
+
+#endif /* OPENCOG_MINER_INFREQUENT_CACHE_H_ */
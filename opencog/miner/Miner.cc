@@ -22,6 +22,9 @@
  */
 
 #include "Miner.h"
+#include "MinerCheckpoint.h"
+#include "MinerLogger.h"
+#include "Surprisingness.h"
 
 #include <opencog/atoms/execution/Instantiator.h>
 #include <opencog/atoms/core/LambdaLink.h>
@@ -33,7 +36,10 @@
 #include <boost/range/numeric.hpp>
 #include <boost/range/algorithm/transform.hpp>
 
+#include <algorithm>
 #include <functional>
+#include <limits>
+#include <queue>
 
 namespace opencog
 {
@@ -44,11 +50,14 @@ namespace opencog
 MinerParameters::MinerParameters(unsigned ms, unsigned iconjuncts,
                                  const Handle& ipat, int maxd)
 	: minsup(ms), initconjuncts(iconjuncts), initpat(ipat),
-	  maxdepth(maxd)
+	  maxdepth(maxd), closed(false), maximal(false), maxiter(100),
+	  maxconjuncts(3), maxvariables(3), maxspcialconjuncts(1),
+	  cnjexp(true), maxcnjexpvariables(2), enfspec(true), maxtime(-1.0),
+	  maxmemory(0), checkpoint_interval(10), resume(false)
 {
 	// Provide initial pattern if none
 	if (not initpat) {
-		HandleSeq vars = MinerUtils::gen_rand_variables(initconjuncts);
+		HandleSeq vars = MinerUtils::gen_variables(initconjuncts);
 		Handle vardecl = MinerUtils::variable_set(vars);
 		Handle body = MinerUtils::mk_body(vars);
 		initpat = MinerUtils::lambda(vardecl, body);
@@ -83,9 +92,453 @@ HandleTree Miner::operator()(const AtomSpace& db_as)
 
 HandleTree Miner::operator()(const HandleSeq& db)
 {
+	// Closed and maximal patterns are not linked by specialization
+	if (param.closed or param.maximal) {
+		HandleTree patterns;
+		mine(db, [&](const Handle& pattern, unsigned) {
+				patterns.insert(patterns.end(), pattern);
+				return true; });
+		return patterns;
+	}
+
+	// Infrequent patterns are only valid for that db
+	infrequent_cache.clear();
 	return specialize(param.initpat, db, param.maxdepth);
 }
 
+bool Miner::mine(const AtomSpace& db_as, const PatternCallback& on_pattern)
+{
+	HandleSeq db;
+	db_as.get_handles_by_type(std::inserter(db, db.end()),
+	                          opencog::ATOM, true);
+	return mine(db, on_pattern);
+}
+
+bool Miner::mine(const HandleSeq& db, const PatternCallback& on_pattern)
+{
+	// Load the db once for all support calculations
+	DbCopyScope db_scope(db);
+
+	// Infrequent and emitted patterns are only valid for that db
+	infrequent_cache.clear();
+	emitted_as.clear();
+	explored_depths.clear();
+	exact_supports.clear();
+	start_time = std::chrono::steady_clock::now();
+	bool condensed = param.closed or param.maximal;
+	HandleSet reported;
+
+	// Frontier of patterns to specialize, alongside their depth
+	// left. Ties are broken in favor of the most recent pattern.
+	struct Entry {
+		double priority;
+		uint64_t order;
+		Handle pattern;
+		int depth;
+		bool operator<(const Entry& other) const {
+			return priority < other.priority or
+				(priority == other.priority and order < other.order);
+		}
+	};
+	std::priority_queue<Entry> frontier;
+	uint64_t order = 0;
+	// Patterns are scored as members of tmp_as, since some
+	// priorities, such as isurp_priority, add subpatterns to the
+	// atomspace of the pattern.
+	tmp_as.clear();
+	auto push = [&](const Handle& pattern, unsigned sup, int depth) {
+		double prio = param.priority ?
+			param.priority(tmp_as.add_atom(pattern), sup, db) : 0.0;
+		frontier.push({prio, order++, pattern, depth});
+	};
+	push(param.initpat, param.minsup, param.maxdepth);
+
+	while (not frontier.empty()) {
+		Entry entry = frontier.top();
+		frontier.pop();
+
+		// One of the termination criteria has been reached. Patterns
+		// at the depth limit are still specialized in closed or
+		// maximal mode, to tell whether they are closed or maximal.
+		if ((entry.depth == 0 and not condensed)
+		    or entry.pattern->get_type() != LAMBDA_LINK
+		    or not MinerUtils::enough_support(entry.pattern, db, param.minsup))
+			continue;
+		HandleSeq npats = shallow_specializations(entry.pattern, db);
+
+		// Report the pattern if closed or maximal, and only keep a
+		// specialization of the same support, if any, since all
+		// closed specializations are reachable from it.
+		if (condensed) {
+			unsigned sup = exact_support(entry.pattern, db);
+			auto same = std::find_if(npats.begin(), npats.end(),
+			                         [&](const Handle& npat) {
+				                         return exact_support(npat, db) == sup; });
+			bool keep = param.maximal ? npats.empty() : same == npats.end();
+			if (same != npats.end())
+				npats = {*same};
+			if (keep and entry.pattern != param.initpat
+			    and reported.insert(emitted_as.add_atom(entry.pattern)).second) {
+				MinerUtils::set_support(entry.pattern, sup);
+				if (not on_pattern(entry.pattern, sup))
+					return false;
+			}
+			if (entry.depth == 0)
+				continue;
+		}
+
+		int depth = entry.depth - 1;
+		for (const Handle& npat : npats) {
+			// Emit npat if new, and skip its specializations if they
+			// have already been explored with as much depth left.
+			unsigned sup = MinerUtils::support_mem(npat, db, param.minsup);
+			Handle known = emitted_as.get_atom(npat);
+			if (known) {
+				int& explored = explored_depths[known];
+				if (explored < 0 or (0 <= depth and depth <= explored))
+					continue;
+				explored = depth;
+			} else {
+				explored_depths[emitted_as.add_atom(npat)] = depth;
+				if (not condensed and not on_pattern(npat, sup))
+					return false;
+			}
+			push(npat, sup, depth);
+		}
+
+		// Leave the rest of the frontier unexplored
+		if (over_budget())
+			break;
+	}
+	return true;
+}
+
+HandleSeq Miner::apriori_mine(const HandleSeq& db)
+{
+	HandleSeq patterns;
+	apriori_mine(db, [&](const Handle& pattern, unsigned) {
+			patterns.push_back(pattern);
+			return true; });
+	return patterns;
+}
+
+bool Miner::apriori_mine(const HandleSeq& db, const PatternCallback& on_pattern)
+{
+	DbCopyScope db_scope(db);
+
+	// Infrequent patterns are only valid for that db
+	infrequent_cache.clear();
+	start_time = std::chrono::steady_clock::now();
+
+	if (param.initpat->get_type() != LAMBDA_LINK
+	    or not MinerUtils::enough_support(param.initpat, db, param.minsup))
+		return true;
+
+	// Patterns generated so far, with their supports, alpha-equivalent
+	// patterns being merged, so that a pattern is only counted at its
+	// lowest depth.
+	AtomSpace level_as;
+	Handle ainitpat = level_as.add_atom(param.initpat);
+	MinerUtils::set_support(ainitpat, MinerUtils::get_support(param.initpat));
+	HandleSeq level{ainitpat};
+
+	// Apriori pruning, a candidate is infrequent if one of its
+	// generalizations has been counted as infrequent at a previous
+	// level. Generalizations that have never been generated, because
+	// they are not specializations of the initial pattern or have too
+	// many variables, are not required to be frequent.
+	auto has_infrequent_parent = [&](const Handle& npat) {
+		for (const Handle& gen : MinerUtils::shallow_generalizations(npat)) {
+			Handle agen = level_as.get_atom(gen);
+			if (not agen)
+				continue;
+			double sup = MinerUtils::get_support(agen);
+			if (0 <= sup and sup < param.minsup)
+				return true;
+		}
+		return false;
+	};
+
+	for (int depth = 1; not level.empty()
+		     and (param.maxdepth < 0 or depth <= param.maxdepth); depth++) {
+		// Generate the candidates of that level from the frequent
+		// patterns of the previous level, pruning those known to be
+		// infrequent or with an infrequent parent.
+		HandleSeq candidates;
+		for (const Handle& pattern : level)
+			for (const Handle& npat : shallow_candidates(pattern, db)) {
+				if (level_as.get_atom(npat))
+					continue;
+				Handle anpat = level_as.add_atom(npat);
+				if (infrequent_cache.is_known_infrequent(npat)
+				    or has_infrequent_parent(npat)) {
+					MinerUtils::set_support(anpat, 0);
+					continue;
+				}
+				candidates.push_back(anpat);
+			}
+
+		// Count all survivors at once
+		std::vector<unsigned> sups =
+			MinerUtils::batch_support(candidates, db, param.minsup);
+		level.clear();
+		for (size_t i = 0; i < candidates.size(); i++) {
+			MinerUtils::set_support(candidates[i], sups[i]);
+			if (sups[i] < param.minsup) {
+				infrequent_cache.insert(candidates[i]);
+				continue;
+			}
+			if (not on_pattern(candidates[i], sups[i]))
+				return false;
+			if (candidates[i]->get_type() == LAMBDA_LINK)
+				level.push_back(candidates[i]);
+		}
+		LAZY_MINER_LOG_DEBUG << "Apriori level " << depth << ": "
+		                     << level.size() << " frequent patterns out of "
+		                     << candidates.size() << " candidates";
+
+		// Leave the next levels unexplored
+		if (over_budget())
+			break;
+	}
+	return true;
+}
+
+HandleSeq Miner::native_mine(const HandleSeq& db)
+{
+	HandleSeq patterns;
+	native_mine(db, [&](const Handle& pattern, unsigned) {
+			patterns.push_back(pattern);
+			return true; });
+	return patterns;
+}
+
+bool Miner::native_mine(const HandleSeq& db, const PatternCallback& on_pattern)
+{
+	DbCopyScope db_scope(db);
+
+	// Infrequent patterns are only valid for that db
+	infrequent_cache.clear();
+	exact_supports.clear();
+	start_time = std::chrono::steady_clock::now();
+	bool condensed = param.closed or param.maximal;
+	bool checkpointing = not param.checkpoint.empty() and not condensed;
+
+	HandleSeq found;
+	if (not MinerUtils::enough_support(param.initpat, db, param.minsup))
+		return true;
+
+	// Alpha-equivalent patterns are merged by that atomspace
+	AtomSpace pat_as;
+	auto insert = [&](const Handle& pattern) {
+		if (pat_as.get_atom(pattern))
+			return true;
+		found.push_back(pat_as.add_atom(pattern));
+		unsigned sup = MinerUtils::support_mem(found.back(), db, param.minsup);
+		return condensed or on_pattern(found.back(), sup);
+	};
+
+	// Patterns with an expansion of the same support, respectively
+	// of enough support, thus not closed, respectively not maximal
+	HandleSet unreported;
+	std::vector<std::pair<Handle, Handle>> links;
+	auto record = [&]() {
+		for (const auto& link : links)
+			if (param.maximal or exact_support(link.first, db)
+			    == exact_support(link.second, db))
+				unreported.insert(pat_as.add_atom(link.first));
+		links.clear();
+	};
+
+	// Save the patterns found so far, i being the next to expand
+	auto save = [&](size_t i) {
+		MinerCheckpoint cp;
+		cp.minsup = param.minsup;
+		cp.db_size = db.size();
+		cp.initpat = param.initpat;
+		cp.patterns = found;
+		for (const Handle& pattern : found)
+			cp.supports.push_back(MinerUtils::get_support(pattern));
+		cp.next = i;
+		if (not cp.save(param.checkpoint))
+			LAZY_MINER_LOG_WARN << "Could not save checkpoint "
+			                    << param.checkpoint;
+	};
+
+	// Restore the patterns found, and their supports, from the last
+	// checkpoint, or start from the initial pattern. The checkpoint is
+	// loaded aside so that an invalid one leaves pat_as untouched.
+	size_t i = 0;
+	MinerCheckpoint cp;
+	AtomSpace cp_as;
+	bool resumed = param.resume and checkpointing
+		and cp.load(param.checkpoint, cp_as);
+	if (resumed and not cp.matches(param.minsup, db.size(), param.initpat)) {
+		LAZY_MINER_LOG_WARN << "Checkpoint " << param.checkpoint
+		                    << " does not match that run, start from scratch";
+		resumed = false;
+	}
+	if (resumed) {
+		LAZY_MINER_LOG_INFO << "Resume from checkpoint " << param.checkpoint
+		                    << " with " << cp.patterns.size()
+		                    << " patterns, " << cp.next << " expanded";
+		for (size_t j = 0; j < cp.patterns.size(); j++) {
+			found.push_back(pat_as.add_atom(cp.patterns[j]));
+			MinerUtils::set_support(found.back(), cp.supports[j]);
+			if (not on_pattern(found.back(), (unsigned)cp.supports[j]))
+				return false;
+		}
+		i = cp.next;
+	} else if (not insert(param.initpat)) {
+		return false;
+	}
+
+	for (; i < found.size()
+		     and (param.maxiter < 0 or i < (size_t)param.maxiter); i++) {
+		if (checkpointing and 0 < i
+		    and i % std::max(1U, param.checkpoint_interval) == 0)
+			save(i);
+		HandleSeq expanded(found.begin(), found.begin() + i + 1);
+		for (const Handle& npat : native_expand(found[i], expanded, db,
+		                                        condensed ? &links : nullptr))
+			if (not insert(npat))
+				return false;
+		record();
+
+		// The expansion of found[i] may have been cut short, thus it
+		// is left as the next pattern to expand
+		if (over_budget()) {
+			LAZY_MINER_LOG_INFO << "Budget exceeded after " << i
+			                    << " iterations, stop with "
+			                    << found.size() << " patterns";
+			break;
+		}
+	}
+	if (checkpointing)
+		save(i);
+
+	// Report the closed or maximal patterns
+	if (condensed)
+		for (const Handle& pattern : found) {
+			if (unreported.find(pattern) != unreported.end())
+				continue;
+			unsigned sup = exact_support(pattern, db);
+			MinerUtils::set_support(pattern, sup);
+			if (not on_pattern(pattern, sup))
+				return false;
+		}
+	return true;
+}
+
+HandleSet Miner::native_expand(const Handle& pattern,
+                               const HandleSeq& expanded,
+                               const HandleSeq& db,
+                               std::vector<std::pair<Handle, Handle>>* links)
+{
+	HandleSet npats;
+	unsigned ms = param.minsup;
+	unsigned pat_cnjs = MinerUtils::n_conjuncts(pattern);
+
+	// Shallow specialization
+	if (pat_cnjs <= param.maxspcialconjuncts) {
+		HandleSet shaspes = MinerUtils::shallow_specialize(pattern, db, ms,
+		                                                   param.maxvariables);
+
+		// In closed or maximal mode, only keep a shallow
+		// specialization of the same support, if any, see mine.
+		if (links) {
+			unsigned sup = exact_support(pattern, db);
+			for (const Handle& shaspe : shaspes)
+				if (exact_support(shaspe, db) == sup) {
+					shaspes = {shaspe};
+					break;
+				}
+			for (const Handle& shaspe : shaspes)
+				links->emplace_back(pattern, shaspe);
+		}
+		npats.insert(shaspes.begin(), shaspes.end());
+	}
+
+	// Conjunction expansion of all pairs of pattern and previously
+	// expanded patterns at once, the second element of each pair
+	// being always unary. Expanding a unary pattern with another one
+	// yields the same conjunctions either way, so such pairs are only
+	// taken in one order, the smallest pattern first. Leave the
+	// patterns found so far to be returned if the budget is already
+	// exceeded.
+	if (not param.cnjexp or is_top(pattern) or over_budget())
+		return npats;
+	std::vector<std::pair<Handle, Handle>> pairs;
+	for (const Handle& other : expanded) {
+		if (is_top(other))
+			continue;
+		unsigned other_cnjs = MinerUtils::n_conjuncts(other);
+		if (other_cnjs == 1 and can_expand_conjunction(pattern)
+		    and (pat_cnjs != 1 or not (other < pattern)))
+			pairs.emplace_back(pattern, other);
+		if (pat_cnjs == 1 and can_expand_conjunction(other)
+		    and (other_cnjs != 1 or other < pattern))
+			pairs.emplace_back(other, pattern);
+	}
+	unsigned mv = std::min(param.maxvariables, param.maxcnjexpvariables);
+	HandleSetSeq cnjss =
+		MinerUtils::expand_conjunction_batch(pairs, db, ms, mv, param.enfspec,
+		                                     &infrequent_cache);
+	// In closed mode, a conjunction with more variables than one of
+	// its parents may have the same support without covering all its
+	// groundings, thus is only linked to parents with as many
+	// variables, the variables of a parent being injectively mapped
+	// to the variables of the conjunction.
+	auto link = [&](const Handle& parent, const Handle& cnj) {
+		if (param.maximal or MinerUtils::get_variables(parent).size()
+		    == MinerUtils::get_variables(cnj).size())
+			links->emplace_back(parent, cnj);
+	};
+	for (size_t i = 0; i < pairs.size(); i++) {
+		if (links)
+			for (const Handle& cnj : cnjss[i]) {
+				link(pairs[i].first, cnj);
+				link(pairs[i].second, cnj);
+			}
+		npats.insert(cnjss[i].begin(), cnjss[i].end());
+	}
+	return npats;
+}
+
+unsigned Miner::exact_support(const Handle& pattern, const HandleSeq& db)
+{
+	auto it = exact_supports.find(pattern);
+	if (it != exact_supports.end())
+		return it->second;
+	unsigned sup = MinerUtils::support(pattern, db,
+	                                   std::numeric_limits<unsigned>::max());
+	return exact_supports[pattern] = sup;
+}
+
+bool Miner::over_budget() const
+{
+	if (0 <= param.maxtime) {
+		std::chrono::duration<double> elapsed =
+			std::chrono::steady_clock::now() - start_time;
+		if (param.maxtime < elapsed.count())
+			return true;
+	}
+	return 0 < param.maxmemory
+		and param.maxmemory < MinerUtils::resident_memory();
+}
+
+bool Miner::is_top(const Handle& pattern)
+{
+	HandleSeq clauses = MinerUtils::get_clauses(pattern);
+	return clauses.size() == 1 and clauses[0]->get_type() == VARIABLE_NODE;
+}
+
+bool Miner::can_expand_conjunction(const Handle& pattern) const
+{
+	return param.maxconjuncts == 0
+		or MinerUtils::n_conjuncts(pattern) < param.maxconjuncts;
+}
+
 HandleTree Miner::specialize(const Handle& pattern,
                              const HandleSeq& db,
                              int maxdepth)
@@ -152,20 +605,75 @@ HandleTree Miner::specialize_alt(const Handle& pattern,
 	return patterns;
 }
 
-bool Miner::terminate(const Handle& pattern,
-                      const HandleSeq& db,
-                      const Valuations& valuations,
-                      int maxdepth) const
+HandleSeq Miner::shallow_specializations(const Handle& pattern,
+                                         const HandleSeq& db)
 {
-	return
-		// We have reached the maximum depth
-		maxdepth == 0 or
-		// The pattern is constant, no specialization is possible
-		pattern->get_type() != LAMBDA_LINK or
-		// There is no more variable to specialize from
-		valuations.no_focus() or
-		// The pattern doesn't have enough support
-		not MinerUtils::enough_support(pattern, db, param.minsup);
+	HandleSeq npats;
+	for (const Handle& npat : shallow_candidates(pattern, db)) {
+		// That specialization is already known not to have enough
+		// support, or doesn't have enough support, skip it.
+		if (infrequent_cache.is_known_infrequent(npat))
+			continue;
+		if (not MinerUtils::enough_support(npat, db, param.minsup)) {
+			infrequent_cache.insert(npat);
+			continue;
+		}
+		npats.push_back(npat);
+	}
+	return npats;
+}
+
+HandleSeq Miner::shallow_candidates(const Handle& pattern,
+                                    const HandleSeq& db) const
+{
+	Valuations valuations(pattern, db);
+	if (valuations.no_focus())
+		return {};
+
+	HandleSeq npats;
+	Variables vars = MinerUtils::get_variables(pattern);
+	HandleSetSeq shabs = MinerUtils::shallow_abstract(valuations, param.minsup);
+	for (unsigned i = 0; i < shabs.size(); i++) {
+		for (const Handle& shapat : shabs[i]) {
+			// Perform the composition (that is specialize)
+			Handle npat = MinerUtils::compose(pattern, {{vars.varseq[i], shapat}});
+
+			// If the specialization has too few conjuncts, dismiss it.
+			if (MinerUtils::n_conjuncts(npat) < param.initconjuncts)
+				continue;
+			npats.push_back(npat);
+		}
+	}
+	return npats;
+}
+
+double Miner::support_priority(const Handle& pattern, unsigned,
+                               const HandleSeq& db)
+{
+	return MinerUtils::support(pattern, db,
+	                           std::numeric_limits<unsigned>::max());
+}
+
+// Number of atoms of a tree
+static size_t tree_size(const Handle& h)
+{
+	size_t size = 1;
+	if (h->is_link())
+		for (const Handle& child : h->getOutgoingSet())
+			size += tree_size(child);
+	return size;
+}
+
+double Miner::size_priority(const Handle& pattern, unsigned,
+                            const HandleSeq&)
+{
+	return -(double)tree_size(MinerUtils::get_body(pattern));
+}
+
+double Miner::isurp_priority(const Handle& pattern, unsigned,
+                             const HandleSeq& db)
+{
+	return Surprisingness::isurp_upper_bound(pattern, db);
 }
 
 HandleTree Miner::specialize_shabs(const Handle& pattern,
@@ -213,10 +721,15 @@ HandleTree Miner::specialize_shapat(const Handle& pattern,
 	if (MinerUtils::n_conjuncts(npat) < param.initconjuncts)
 		return HandleTree();
 
-	// That specialization doesn't have enough support, skip it
-	// and its specializations.
-	if (not MinerUtils::enough_support(npat, db, param.minsup))
+	// That specialization is already known not to have enough
+	// support, or doesn't have enough support, skip it and its
+	// specializations.
+	if (infrequent_cache.is_known_infrequent(npat))
 		return HandleTree();
+	if (not MinerUtils::enough_support(npat, db, param.minsup)) {
+		infrequent_cache.insert(npat);
+		return HandleTree();
+	}
 
 	// Specialize npat from all variables (with new valuations)
 	HandleTree nvapats = specialize(npat, db, maxdepth - 1);
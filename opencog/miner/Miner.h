@@ -28,15 +28,30 @@
 #include <opencog/atoms/core/RewriteLink.h>
 #include <opencog/atomspace/AtomSpace.h>
 
+#include <chrono>
+#include <functional>
+#include <string>
+#include <unordered_map>
+
 #include "HandleTree.h"
 #include "Valuations.h"
 #include "MinerUtils.h"
+#include "InfrequentCache.h"
 
 class MinerUTest;
 
 namespace opencog
 {
 
+/**
+ * Priority of a pattern in the frontier of Miner::mine, given its
+ * support (possibly capped, see PatternCallback) and the db. Patterns
+ * of higher priority are specialized first. The pattern passed
+ * belongs to a scratch atomspace of the miner, where subpatterns may
+ * be added.
+ */
+typedef std::function<double(const Handle&, unsigned, const HandleSeq&)> PatternPriority;
+
 /**
  * Parameters for Miner. The terminology is taken from
  * Frequent Subtree Mining -- An Overview, from Yun Chi et al, when
@@ -77,8 +92,73 @@ struct MinerParameters {
 	// depth limit. Depth is the number of specializations between the
 	// initial pattern and the produced patterns.
 	int maxdepth;
+
+	// Priority of the patterns to specialize next in Miner::mine, see
+	// Miner::support_priority, Miner::size_priority and
+	// Miner::isurp_priority. If empty, then the most recently found
+	// pattern is specialized first, that is the search is depth
+	// first.
+	PatternPriority priority;
+
+	// Only produce closed patterns, that is without specialization of
+	// the same support, or maximal patterns, that is without
+	// specialization of enough support, see Miner::mine and
+	// Miner::native_mine. Supports are then calculated exactly,
+	// rather than up to minsup, to be compared.
+	bool closed;
+	bool maximal;
+
+	// The following parameters are only used by Miner::native_mine,
+	// and mirror those of cog-mine, with the same defaults.
+
+	// Maximum number of iterations, each iteration expanding one
+	// pattern. If negative, then no iteration limit.
+	int maxiter;
+
+	// Maximum number of conjuncts of the produced patterns. If 0,
+	// then no limit.
+	unsigned maxconjuncts;
+
+	// Maximum number of variables of the produced patterns.
+	unsigned maxvariables;
+
+	// Maximum number of conjuncts of a pattern to apply shallow
+	// specialization to.
+	unsigned maxspcialconjuncts;
+
+	// Whether conjunction expansion is used, and if so the maximum
+	// number of variables of its patterns, and whether it only
+	// produces specializations.
+	bool cnjexp;
+	unsigned maxcnjexpvariables;
+	bool enfspec;
+
+	// Wall-clock time in seconds and resident memory in bytes the
+	// search may use, also by Miner::mine and Miner::apriori_mine.
+	// Once either is exceeded no more pattern is expanded, and the
+	// patterns found so far are returned. If negative, respectively
+	// 0, then no limit.
+	double maxtime;
+	size_t maxmemory;
+
+	// File to checkpoint the state of the search to, see
+	// MinerCheckpoint, every checkpoint_interval iterations and once
+	// done. If empty, then no checkpoint is saved.
+	std::string checkpoint;
+	unsigned checkpoint_interval;
+
+	// Whether to resume the search from checkpoint, if it exists and
+	// has been saved with the same minimum support, initial pattern
+	// and db size. Otherwise the search starts from scratch.
+	bool resume;
 };
 
+/**
+ * Callback receiving a pattern with enough support alongside its
+ * support. Returning false stops the search.
+ */
+typedef std::function<bool(const Handle&, unsigned)> PatternCallback;
+
 /**
  * Experimental pattern miner. Mined patterns should be compatible
  * with the pattern matcher, that is if feed to the pattern matcher,
@@ -105,9 +185,70 @@ public:
 
 	/**
 	 * Like above but only mine amongst the provided data tree collection.
+	 *
+	 * If param.closed or param.maximal is set, then the patterns are
+	 * produced by mine instead, and returned as a flat forest.
 	 */
 	HandleTree operator()(const HandleSeq& db);
 
+	/**
+	 * Like operator() but, rather than building a tree of patterns,
+	 * call on_pattern on each pattern with enough support as soon as
+	 * it is found, so that patterns can be processed while the search
+	 * goes on. The support passed is the one calculated to decide
+	 * whether the pattern reaches minsup, thus may be capped, see
+	 * MinerUtils::support.
+	 *
+	 * Rather than recursing, the patterns found are kept in a
+	 * frontier and specialized by decreasing param.priority, so
+	 * that a run cut short by param.maxtime or param.maxmemory has
+	 * found the most valuable patterns first.
+	 *
+	 * Each pattern, up to alpha-equivalence, is passed once, and only
+	 * specialized again if reached with more depth left than
+	 * before. If on_pattern returns false the search stops.
+	 *
+	 * If param.closed or param.maximal is set, a pattern is passed,
+	 * with its exact support, once its specializations are known, and
+	 * only if it is closed, respectively maximal. Besides, if one of
+	 * its specializations has the same support, then all its
+	 * valuations match that specialization, thus the other
+	 * specializations are not closed and their closed
+	 * specializations can be reached from that one. They are then
+	 * left unexplored. That is exact without depth limit, otherwise
+	 * closed patterns at the depth limit may be missed.
+	 *
+	 * Return false iff the search has been stopped by on_pattern.
+	 */
+	bool mine(const AtomSpace& db_as, const PatternCallback& on_pattern);
+	bool mine(const HandleSeq& db, const PatternCallback& on_pattern);
+
+	/**
+	 * Level-wise alternative to mine. Candidates of depth d, that is
+	 * obtained by d specializations of the initial pattern, are
+	 * generated from the patterns of depth d-1 with enough support.
+	 * Candidates known to be infrequent, see
+	 * InfrequentCache::is_known_infrequent, or having a
+	 * generalization, see MinerUtils::shallow_generalizations, found
+	 * infrequent at a previous level, are pruned. Then the supports
+	 * of all remaining candidates are calculated at once with
+	 * MinerUtils::batch_support, up to param.maxdepth levels.
+	 *
+	 * Patterns are thus produced later than with mine. Each level
+	 * runs the pattern matcher once per distinct component of its
+	 * candidates, rather than once per candidate, which pays off on
+	 * large batch runs.
+	 *
+	 * Return the patterns with enough support, initial pattern
+	 * excluded, by increasing depth. The callback variant passes
+	 * them to on_pattern, level by level, alongside their supports.
+	 * They belong to an atomspace that only lives during the call,
+	 * thus must be copied to outlive it. Return false iff the search
+	 * has been stopped by on_pattern.
+	 */
+	HandleSeq apriori_mine(const HandleSeq& db);
+	bool apriori_mine(const HandleSeq& db, const PatternCallback& on_pattern);
+
 	/**
 	 * Specialization. Given a pattern and a collection of data trees,
 	 * generate all specialized patterns of the given pattern.
@@ -133,13 +274,166 @@ public:
 	                          const Valuations& valuations,
 	                          int maxdepth);
 
+	/**
+	 * Mine db the way cog-mine does with its default rules, that is
+	 * shallow specialization and conjunction expansion, but without
+	 * the URE, thus without rule unification and minsup evaluation
+	 * bookkeeping.
+	 *
+	 * Patterns are expanded in the order they are found, starting
+	 * from the initial pattern, one per iteration, up to
+	 * param.maxiter iterations. Expanding a pattern means
+	 *
+	 * 1. if it has at most param.maxspcialconjuncts conjuncts, adding
+	 *    its shallow specializations,
+	 *
+	 * 2. if param.cnjexp is true, adding its conjunction expansions
+	 *    with all unary patterns expanded so far (itself included),
+	 *    and, if it is unary itself, the conjunction expansions of
+	 *    all patterns expanded so far with it, within
+	 *    param.maxconjuncts conjuncts. That way each pair of patterns
+	 *    is considered once.
+	 *
+	 * Return all patterns with enough support, including the initial
+	 * pattern, alpha-equivalent patterns appearing once, in the
+	 * order they were found. If the initial pattern does not have
+	 * enough support, return the empty sequence.
+	 *
+	 * The search also stops early once param.maxtime or
+	 * param.maxmemory is exceeded, in which case the patterns found so
+	 * far are returned, alongside their memoized supports.
+	 *
+	 * If param.closed or param.maximal is set, since a conjunction
+	 * may specialize a pattern expanded earlier, patterns are only
+	 * passed once the search is over, with their exact supports, and
+	 * only if none of their expansions found has the same support,
+	 * respectively enough support. Besides, if one of the shallow
+	 * specializations of a pattern has the same support, its other
+	 * shallow specializations are skipped, as in mine. Checkpointing
+	 * is not supported in that case.
+	 *
+	 * If param.checkpoint is set, the patterns found so far, their
+	 * supports and the next pattern to expand are saved to it along
+	 * the way. If param.resume is set as well, the search restarts
+	 * from there, without recalculating the supports of the patterns
+	 * already found, nor expanding them again.
+	 */
+	HandleSeq native_mine(const HandleSeq& db);
+
+	/**
+	 * Like above but pass each pattern to on_pattern, alongside its
+	 * support, as soon as it is found, see mine. Patterns belong to
+	 * an atomspace that only lives during the call, thus must be
+	 * copied to outlive it.
+	 *
+	 * Return false iff the search has been stopped by on_pattern.
+	 */
+	bool native_mine(const HandleSeq& db, const PatternCallback& on_pattern);
+
+	/**
+	 * Priorities to plug into MinerParameters::priority.
+	 *
+	 * support_priority: the support of the pattern, uncapped, thus
+	 * calculated anew. Frequent patterns are specialized first.
+	 *
+	 * size_priority: the opposite of the number of atoms of the
+	 * pattern body. Abstract patterns are specialized first, which
+	 * amounts to a breadth first search.
+	 *
+	 * isurp_priority: the upper bound of the normalized
+	 * I-Surprisingness of the pattern, see
+	 * Surprisingness::isurp_upper_bound.
+	 */
+	static double support_priority(const Handle& pattern, unsigned,
+	                               const HandleSeq& db);
+	static double size_priority(const Handle& pattern, unsigned,
+	                            const HandleSeq&);
+	static double isurp_priority(const Handle& pattern, unsigned,
+	                             const HandleSeq& db);
+
 	// Parameters
 	MinerParameters param;
 
 private:
 
+	// Scratch atomspace holding the patterns scored by
+	// param.priority during the current run of mine
 	mutable AtomSpace tmp_as;
 
+	// Patterns found not to reach minsup during the current run, so
+	// that they, and patterns containing them, are not reconsidered
+	// when reached from another path.
+	InfrequentCache infrequent_cache;
+
+	// Patterns passed to the callback during the current run of
+	// mine, alongside the depth left they have been specialized with
+	// (negative meaning unlimited).
+	AtomSpace emitted_as;
+	std::unordered_map<Handle, int> explored_depths;
+
+	// Start time of the current run of native_mine, mine or
+	// apriori_mine
+	std::chrono::steady_clock::time_point start_time;
+
+	/**
+	 * Return the specializations of pattern with enough support
+	 * obtained by composing each of its variables with one of its
+	 * shallow abstractions, as in specialize_alt.
+	 */
+	HandleSeq shallow_specializations(const Handle& pattern,
+	                                  const HandleSeq& db);
+
+	/**
+	 * Like shallow_specializations but without checking the support
+	 * of the specializations.
+	 */
+	HandleSeq shallow_candidates(const Handle& pattern,
+	                             const HandleSeq& db) const;
+
+	/**
+	 * Return the patterns obtained by expanding pattern as described
+	 * in native_mine, given the patterns expanded so far.
+	 *
+	 * If links is provided, each pair of a pattern and one of its
+	 * expansions is appended to it, conjunctions being paired with
+	 * both patterns they are made of. In closed mode, conjunctions
+	 * are only paired with the patterns with as many variables, as
+	 * the support of a conjunction with more variables says nothing
+	 * about the closedness of the pattern.
+	 */
+	HandleSet native_expand(const Handle& pattern,
+	                        const HandleSeq& expanded,
+	                        const HandleSeq& db,
+	                        std::vector<std::pair<Handle, Handle>>* links=nullptr);
+
+	/**
+	 * Return the exact support of pattern, memoized over the current
+	 * run, for the closed and maximal modes.
+	 */
+	unsigned exact_support(const Handle& pattern, const HandleSeq& db);
+
+	// Exact supports of the patterns of the current run
+	std::unordered_map<Handle, unsigned> exact_supports;
+
+	/**
+	 * Return true iff the current run of native_mine, mine or
+	 * apriori_mine has exceeded param.maxtime or param.maxmemory.
+	 */
+	bool over_budget() const;
+
+	/**
+	 * Return true iff pattern is the top pattern, that is
+	 *
+	 * Lambda X X
+	 */
+	static bool is_top(const Handle& pattern);
+
+	/**
+	 * Return true iff pattern has fewer than param.maxconjuncts
+	 * conjuncts, and thus can be expanded by a conjunction.
+	 */
+	bool can_expand_conjunction(const Handle& pattern) const;
+
 	/**
 	 * Return true iff maxdepth is null or pattern is not a lambda or
 	 * doesn't have enough support. Additionally the second one check
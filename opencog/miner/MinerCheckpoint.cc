@@ -0,0 +1,268 @@
+/*
+ * MinerCheckpoint.cc
+ *
+ * Copyright (C) 2020 SingularityNET Foundation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License v3 as
+ * published by the Free Software Foundation and including the exceptions
+ * at http://opencog.org/wiki/Licenses
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program; if not, write to:
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "MinerCheckpoint.h"
+#include "MinerLogger.h"
+
+#include <opencog/atoms/atom_types/NameServer.h>
+#include <opencog/atoms/base/Node.h>
+#include <opencog/atoms/base/Link.h>
+
+#include <cstdio>
+#include <fstream>
+#include <unordered_map>
+
+namespace opencog
+{
+
+// Identifies a checkpoint file, and its format version
+static const char magic[4] = {'O', 'C', 'M', 'C'};
+static const uint32_t version = 1;
+
+template<typename T>
+static void write_raw(std::ostream& out, const T& v)
+{
+	out.write(reinterpret_cast<const char*>(&v), sizeof(T));
+}
+
+template<typename T>
+static bool read_raw(std::istream& in, T& v)
+{
+	return (bool)in.read(reinterpret_cast<char*>(&v), sizeof(T));
+}
+
+static void write_string(std::ostream& out, const std::string& s)
+{
+	write_raw(out, (uint32_t)s.size());
+	out.write(s.data(), s.size());
+}
+
+static bool read_string(std::istream& in, std::string& s)
+{
+	uint32_t size;
+	if (not read_raw(in, size))
+		return false;
+	s.resize(size);
+	return (bool)in.read(&s[0], size);
+}
+
+/**
+ * Atoms of a checkpoint, written children first, each referred to
+ * by its index in the table, and types by their index in a table of
+ * type names.
+ */
+class AtomTableWriter
+{
+public:
+	uint32_t add(const Handle& h)
+	{
+		auto it = _ids.find(h);
+		if (it != _ids.end())
+			return it->second;
+		std::vector<uint32_t> children;
+		if (h->is_link())
+			for (const Handle& child : h->getOutgoingSet())
+				children.push_back(add(child));
+
+		Type t = h->get_type();
+		auto tit = _type_ids.find(t);
+		if (tit == _type_ids.end()) {
+			tit = _type_ids.emplace(t, (uint32_t)_type_names.size()).first;
+			_type_names.push_back(nameserver().getTypeName(t));
+		}
+		_records.push_back({tit->second, h->is_node(), h->is_node() ?
+		                    h->get_name() : std::string(), children});
+		return _ids[h] = (uint32_t)_records.size() - 1;
+	}
+
+	void write(std::ostream& out) const
+	{
+		write_raw(out, (uint32_t)_type_names.size());
+		for (const std::string& name : _type_names)
+			write_string(out, name);
+		write_raw(out, (uint32_t)_records.size());
+		for (const Record& rec : _records) {
+			write_raw(out, rec.type);
+			write_raw(out, (uint8_t)rec.is_node);
+			if (rec.is_node) {
+				write_string(out, rec.name);
+			} else {
+				write_raw(out, (uint32_t)rec.children.size());
+				for (uint32_t child : rec.children)
+					write_raw(out, child);
+			}
+		}
+	}
+
+private:
+	struct Record {
+		uint32_t type;
+		bool is_node;
+		std::string name;
+		std::vector<uint32_t> children;
+	};
+	std::unordered_map<Handle, uint32_t> _ids;
+	std::unordered_map<Type, uint32_t> _type_ids;
+	std::vector<std::string> _type_names;
+	std::vector<Record> _records;
+};
+
+static bool read_atom_table(std::istream& in, AtomSpace& as, HandleSeq& atoms)
+{
+	uint32_t n_types;
+	if (not read_raw(in, n_types))
+		return false;
+	std::vector<Type> types(n_types);
+	for (Type& t : types) {
+		std::string name;
+		if (not read_string(in, name))
+			return false;
+		t = nameserver().getType(name);
+		if (t == NOTYPE)
+			return false;
+	}
+
+	uint32_t n_atoms;
+	if (not read_raw(in, n_atoms))
+		return false;
+	atoms.reserve(n_atoms);
+	for (uint32_t i = 0; i < n_atoms; i++) {
+		uint32_t type_id;
+		uint8_t is_node;
+		if (not read_raw(in, type_id) or n_types <= type_id
+		    or not read_raw(in, is_node))
+			return false;
+		Type t = types[type_id];
+		if (is_node) {
+			std::string name;
+			if (not read_string(in, name))
+				return false;
+			atoms.push_back(as.add_node(t, std::move(name)));
+		} else {
+			uint32_t arity;
+			if (not read_raw(in, arity))
+				return false;
+			HandleSeq outgoing(arity);
+			for (Handle& child : outgoing) {
+				uint32_t child_id;
+				if (not read_raw(in, child_id) or atoms.size() <= child_id)
+					return false;
+				child = atoms[child_id];
+			}
+			atoms.push_back(as.add_link(t, std::move(outgoing)));
+		}
+	}
+	return true;
+}
+
+MinerCheckpoint::MinerCheckpoint()
+	: minsup(0), db_size(0), next(0) {}
+
+bool MinerCheckpoint::save(const std::string& filename) const
+{
+	std::string tmp_filename = filename + ".tmp";
+	{
+		std::ofstream out(tmp_filename, std::ios::binary | std::ios::trunc);
+		if (not out)
+			return false;
+
+		AtomTableWriter table;
+		uint32_t initpat_id = table.add(initpat);
+		std::vector<uint32_t> pattern_ids;
+		for (const Handle& pattern : patterns)
+			pattern_ids.push_back(table.add(pattern));
+
+		out.write(magic, sizeof(magic));
+		write_raw(out, version);
+		table.write(out);
+		write_raw(out, (uint32_t)minsup);
+		write_raw(out, db_size);
+		write_raw(out, initpat_id);
+		write_raw(out, (uint64_t)patterns.size());
+		for (size_t i = 0; i < patterns.size(); i++) {
+			write_raw(out, pattern_ids[i]);
+			write_raw(out, supports[i]);
+		}
+		write_raw(out, next);
+		if (not out)
+			return false;
+	}
+	return std::rename(tmp_filename.c_str(), filename.c_str()) == 0;
+}
+
+bool MinerCheckpoint::load(const std::string& filename, AtomSpace& as)
+{
+	std::ifstream in(filename, std::ios::binary);
+	if (not in)
+		return false;
+
+	char mgc[sizeof(magic)];
+	uint32_t vrsn;
+	if (not in.read(mgc, sizeof(mgc))
+	    or not std::equal(mgc, mgc + sizeof(mgc), magic)
+	    or not read_raw(in, vrsn) or vrsn != version) {
+		LAZY_MINER_LOG_WARN << "Not a valid checkpoint: " << filename;
+		return false;
+	}
+
+	// Read the whole checkpoint before overwriting this one
+	HandleSeq atoms;
+	uint32_t ms, initpat_id;
+	uint64_t dbs, n_patterns, nxt;
+	bool ok = read_atom_table(in, as, atoms)
+		and read_raw(in, ms) and read_raw(in, dbs)
+		and read_raw(in, initpat_id) and initpat_id < atoms.size()
+		and read_raw(in, n_patterns);
+	HandleSeq pats;
+	std::vector<double> sups;
+	for (uint64_t i = 0; ok and i < n_patterns; i++) {
+		uint32_t pattern_id;
+		double sup;
+		ok = read_raw(in, pattern_id) and pattern_id < atoms.size()
+			and read_raw(in, sup);
+		if (ok) {
+			pats.push_back(atoms[pattern_id]);
+			sups.push_back(sup);
+		}
+	}
+	ok = ok and read_raw(in, nxt) and nxt <= n_patterns;
+	if (not ok) {
+		LAZY_MINER_LOG_WARN << "Corrupted checkpoint: " << filename;
+		return false;
+	}
+
+	minsup = ms;
+	db_size = dbs;
+	initpat = atoms[initpat_id];
+	patterns = std::move(pats);
+	supports = std::move(sups);
+	next = nxt;
+	return true;
+}
+
+bool MinerCheckpoint::matches(unsigned ms, uint64_t dbs,
+                              const Handle& ipat) const
+{
+	return minsup == ms and db_size == dbs and initpat and ipat
+		and content_eq(initpat, ipat);
+}
+
+} // ~namespace opencog
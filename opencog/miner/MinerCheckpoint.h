@@ -0,0 +1,88 @@
+/*
+ * MinerCheckpoint.h
+ *
+ * Copyright (C) 2020 SingularityNET Foundation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License v3 as
+ * published by the Free Software Foundation and including the exceptions
+ * at http://opencog.org/wiki/Licenses
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program; if not, write to:
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef OPENCOG_MINER_CHECKPOINT_H_
+#define OPENCOG_MINER_CHECKPOINT_H_
+
+#include <opencog/atoms/base/Handle.h>
+#include <opencog/atomspace/AtomSpace.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace opencog
+{
+
+/**
+ * State of a run of Miner::native_mine, so that it can be saved to
+ * and restored from a file, and a long run resumed after a crash or
+ * a restart.
+ *
+ * The file is binary. Atoms are stored once each, children before
+ * parents, with their types by name, so that atoms shared between
+ * patterns, such as data tree atoms, take no extra space.
+ */
+struct MinerCheckpoint {
+	// Minimum support, size of the db and initial pattern of the run,
+	// to check that a checkpoint is resumed with the same problem.
+	unsigned minsup;
+	uint64_t db_size;
+	Handle initpat;
+
+	// Patterns found so far, in order of discovery, alongside their
+	// memoized supports, see MinerUtils::support_mem.
+	HandleSeq patterns;
+	std::vector<double> supports;
+
+	// Index in patterns of the next pattern to expand. Patterns
+	// before it have been expanded, the others form the frontier.
+	uint64_t next;
+
+	MinerCheckpoint();
+
+	/**
+	 * Write the checkpoint to filename. It is first written to a
+	 * temporary file then renamed, so that a crash while saving does
+	 * not lose the previous checkpoint. Return false if it could not
+	 * be written.
+	 */
+	bool save(const std::string& filename) const;
+
+	/**
+	 * Read the checkpoint from filename, adding its atoms to as.
+	 * Return false, leaving the checkpoint unchanged, if filename
+	 * does not exist or is not a valid checkpoint. Atoms read before
+	 * an error is detected remain in as, thus as should be a scratch
+	 * atomspace, its content copied elsewhere once the checkpoint is
+	 * known to be valid and to match the run, see matches.
+	 */
+	bool load(const std::string& filename, AtomSpace& as);
+
+	/**
+	 * Return true iff the checkpoint has been saved from a run with
+	 * the given minimum support, db size and initial pattern.
+	 */
+	bool matches(unsigned ms, uint64_t dbs, const Handle& ipat) const;
+};
+
+} // ~namespace opencog
+
+#endif /* OPENCOG_MINER_CHECKPOINT_H_ */
@@ -23,15 +23,23 @@
 
 #ifdef HAVE_GUILE
 
+#include <algorithm>
 #include <cmath>
+#include <map>
+#include <memory>
+#include <mutex>
+
+#include <boost/functional/hash.hpp>
 
 #include <opencog/util/Logger.h>
 #include <opencog/guile/SchemeModule.h>
 #include <opencog/atoms/core/NumberNode.h>
+#include <opencog/atoms/truthvalue/SimpleTruthValue.h>
 
 #include "MinerUtils.h"
 #include "Surprisingness.h"
 #include "MinerLogger.h"
+#include "InfrequentCache.h"
 
 namespace opencog {
 
@@ -84,6 +92,15 @@ protected:
 	Handle do_shallow_specialize(Handle pattern, Handle db,
 	                             Handle ms, Handle mv);
 
+	/**
+	 * Like do_shallow_specialize but over a List of patterns,
+	 * returning the Set of the shallow specializations of all of
+	 * them, see MinerUtils::shallow_specialize_batch. The db snapshot
+	 * is fetched once for all patterns.
+	 */
+	Handle do_shallow_specialize_batch(Handle patterns, Handle db,
+	                                   Handle ms, Handle mv);
+
 	/**
 	 * Given a pattern, a db concept and a minimum support, return
 	 * true iff the pattern has enough support.
@@ -102,6 +119,52 @@ protected:
 	Handle do_expand_conjunction(Handle cnjtion, Handle pattern, Handle db,
 	                             Handle ms, Handle mv, bool es);
 
+	/**
+	 * Like do_expand_conjunction but over a List of pairs, each pair
+	 * being a List of a conjunction and a pattern, returning the Set
+	 * of the expansions of all of them. The db snapshot and the cache
+	 * of infrequent patterns are fetched once for all pairs.
+	 */
+	Handle do_expand_conjunction_batch(Handle pairs, Handle db,
+	                                   Handle ms, Handle mv, bool es);
+
+	/**
+	 * Mine db with minimum support ms from initpat, natively rather
+	 * than through the URE, see Miner::native_mine, and return the
+	 * Set of all patterns found.
+	 *
+	 * params is a List of number nodes with the maximum number of
+	 * iterations, conjuncts, variables, conjuncts to apply shallow
+	 * specialization to, variables of conjunction expansion, then
+	 * whether to use conjunction expansion and to enforce
+	 * specialization (0 for false, any other number for true), the
+	 * maximum time in seconds and resident memory in bytes, and
+	 * whether to only produce closed, respectively maximal, patterns,
+	 * in that order. These may be followed by a node named after the
+	 * checkpoint file, the checkpoint interval, and whether to resume
+	 * from the checkpoint, see MinerParameters.
+	 */
+	Handle do_native_mine(Handle db, Handle ms, Handle initpat,
+	                      Handle params);
+
+	/**
+	 * Like do_native_mine but score the patterns with more than one
+	 * conjunct as they are mined, see Surprisingness::pipelined_isurp,
+	 * and return a Set of evaluations as do_isurp_batch.
+	 */
+	Handle do_native_mine_isurp(Handle db, Handle ms, Handle initpat,
+	                            Handle params, Handle db_ratio);
+	Handle do_native_mine_nisurp(Handle db, Handle ms, Handle initpat,
+	                             Handle params, Handle db_ratio);
+	Handle native_mine_isurp(Handle db, Handle ms, Handle initpat,
+	                         Handle params, Handle db_ratio, bool normalize);
+
+	/**
+	 * Build the miner parameters of do_native_mine
+	 */
+	MinerParameters get_native_parameters(Handle ms, Handle initpat,
+	                                      Handle params);
+
 	/**
 	 * Calculate the I-Surprisingness of the pattern (and its
 	 * partitions) with respect to db.
@@ -116,6 +179,50 @@ protected:
 	double do_isurp(Handle pattern, Handle db, Handle db_ratio);
 	double do_nisurp(Handle pattern, Handle db, Handle db_ratio);
 
+	/**
+	 * Like do_isurp and do_nisurp but over a set of patterns at once,
+	 * sharing the evaluation of their common subpatterns. Patterns
+	 * with less than 2 conjuncts are ignored.
+	 *
+	 * Return a set of evaluations
+	 *
+	 * Evaluation (stv <surprisingness> 1)
+	 *   Predicate "isurp" (or "nisurp")
+	 *   List
+	 *     <pattern>
+	 *     <db>
+	 */
+	Handle do_isurp_batch(Handle patterns, Handle db, Handle db_ratio);
+	Handle do_nisurp_batch(Handle patterns, Handle db, Handle db_ratio);
+	Handle isurp_batch(Handle patterns, Handle db, Handle db_ratio,
+	                   bool normalize);
+
+	/**
+	 * Like do_isurp_batch and do_nisurp_batch but only return the
+	 * evaluations of the k most surprising patterns, see
+	 * Surprisingness::isurp_top_k.
+	 */
+	Handle do_isurp_top_k(Handle patterns, Handle db, Handle k, Handle db_ratio);
+	Handle do_nisurp_top_k(Handle patterns, Handle db, Handle k, Handle db_ratio);
+	Handle isurp_top_k(Handle patterns, Handle db, Handle k, Handle db_ratio,
+	                   bool normalize);
+
+	/**
+	 * Wrap patterns and their scores in evaluations
+	 *
+	 * Evaluation (stv <score> 1)
+	 *   Predicate <pred_name>
+	 *   List
+	 *     <pattern>
+	 *     <db>
+	 *
+	 * and return them in a SetLink.
+	 */
+	Handle mk_surp_evals(AtomSpace* as, const std::string& pred_name,
+	                     const HandleSeq& patterns,
+	                     const std::vector<double>& scores,
+	                     const Handle& db);
+
 	/**
 	 * Calculate the empirical truth value of pattern
 	 */
@@ -131,11 +238,98 @@ protected:
 	 */
 	double do_jsd(TruthValuePtr ltv, TruthValuePtr rtv);
 
+	/**
+	 * Set the number of threads used by the surprisingness
+	 * measures to evaluate partitions concurrently.
+	 */
+	void do_set_surprisingness_jobs(Handle jobs);
+
+	/**
+	 * Set the tolerance and the maximum number of resamples of the
+	 * adaptive bootstrapping used to calculate empirical
+	 * probabilities during surprisingness.
+	 */
+	void do_set_surprisingness_bootstrap(Handle tolerance, Handle max_resamples);
+
+	/**
+	 * Set the relative error tolerated on the value counts used by
+	 * surprisingness, 0 meaning exact counts.
+	 */
+	void do_set_surprisingness_value_count_error(Handle error);
+
+	/**
+	 * Set the maximum number of partitions evaluated per pattern by
+	 * surprisingness, 0 meaning all of them.
+	 */
+	void do_set_surprisingness_maximum_partitions(Handle max_prtns);
+
+	/**
+	 * Return the current surprisingness settings, as a list of
+	 * number nodes, that is the jobs, the bootstrap tolerance, the
+	 * maximum number of resamples, the value count error and the
+	 * maximum number of partitions, so that they can be restored.
+	 */
+	Handle do_surprisingness_settings();
+
 	/**
 	 * Return the Miner logger
 	 */
 	Logger* do_miner_logger();
 
+	/**
+	 * Snapshots of the members of db concepts, alongside the hash of
+	 * the member links they have been built from, so that they only
+	 * get rebuilt when the membership of the db changes, and the time
+	 * they were last used. At most max_dbs snapshots are kept, the
+	 * least recently used being evicted first. Each snapshot shares
+	 * its db copy (see MinerUtils::share_db_copy) for as long as it
+	 * lives.
+	 */
+	typedef std::shared_ptr<const HandleSeq> DbPtr;
+	struct DbSnapshot
+	{
+		size_t members_hash;
+		DbPtr db;
+		unsigned long last_use;
+	};
+	std::map<Handle, DbSnapshot> _dbs;
+	unsigned long _db_uses = 0;
+	std::mutex _dbs_mutex;
+	static const size_t max_dbs = 8;
+
+	/**
+	 * Return the members of db, like MinerUtils::get_db, but from its
+	 * snapshot unless its member links have changed.
+	 */
+	DbPtr get_db(const Handle& db);
+
+	/**
+	 * Caches of infrequent patterns per db concept and minimum
+	 * support, alongside the db snapshot they have been built for,
+	 * so that they get discarded when the snapshot is. At most
+	 * max_infrequent_caches caches are kept, the least recently used
+	 * being evicted first.
+	 */
+	struct DbInfrequentCache
+	{
+		std::weak_ptr<const HandleSeq> db;
+		std::shared_ptr<InfrequentCache> cache;
+		unsigned long last_use;
+	};
+	std::map<std::pair<Handle, unsigned>, DbInfrequentCache> _infrequent_caches;
+	unsigned long _infrequent_cache_uses = 0;
+	std::mutex _infrequent_caches_mutex;
+	static const size_t max_infrequent_caches = 32;
+
+	/**
+	 * Return the cache of infrequent patterns associated to db and
+	 * ms, creating it if necessary, or if db_ptr, the current
+	 * snapshot of db, is not the one it was built for.
+	 */
+	std::shared_ptr<InfrequentCache> get_infrequent_cache(const Handle& db,
+	                                                      const DbPtr& db_ptr,
+	                                                      unsigned ms);
+
 public:
 	MinerSCM();
 };
@@ -161,12 +355,27 @@ void MinerSCM::init(void)
 	define_scheme_primitive("cog-shallow-specialize",
 		&MinerSCM::do_shallow_specialize, this, "miner");
 
+	define_scheme_primitive("cog-shallow-specialize-batch",
+		&MinerSCM::do_shallow_specialize_batch, this, "miner");
+
 	define_scheme_primitive("cog-enough-support?",
 		&MinerSCM::do_enough_support, this, "miner");
 
 	define_scheme_primitive("cog-expand-conjunction",
 		&MinerSCM::do_expand_conjunction, this, "miner");
 
+	define_scheme_primitive("cog-expand-conjunction-batch",
+		&MinerSCM::do_expand_conjunction_batch, this, "miner");
+
+	define_scheme_primitive("cog-native-mine",
+		&MinerSCM::do_native_mine, this, "miner");
+
+	define_scheme_primitive("cog-native-mine-isurp",
+		&MinerSCM::do_native_mine_isurp, this, "miner");
+
+	define_scheme_primitive("cog-native-mine-nisurp",
+		&MinerSCM::do_native_mine_nisurp, this, "miner");
+
 	define_scheme_primitive("cog-isurp-old",
 		&MinerSCM::do_isurp_old, this, "miner");
 
@@ -179,6 +388,18 @@ void MinerSCM::init(void)
 	define_scheme_primitive("cog-nisurp",
 		&MinerSCM::do_nisurp, this, "miner");
 
+	define_scheme_primitive("cog-isurp-batch",
+		&MinerSCM::do_isurp_batch, this, "miner");
+
+	define_scheme_primitive("cog-nisurp-batch",
+		&MinerSCM::do_nisurp_batch, this, "miner");
+
+	define_scheme_primitive("cog-isurp-top-k",
+		&MinerSCM::do_isurp_top_k, this, "miner");
+
+	define_scheme_primitive("cog-nisurp-top-k",
+		&MinerSCM::do_nisurp_top_k, this, "miner");
+
 	define_scheme_primitive("cog-emp-tv",
 		&MinerSCM::do_emp_tv, this, "miner");
 
@@ -188,6 +409,21 @@ void MinerSCM::init(void)
 	define_scheme_primitive("cog-jsd",
 		&MinerSCM::do_jsd, this, "miner");
 
+	define_scheme_primitive("cog-set-surprisingness-jobs!",
+		&MinerSCM::do_set_surprisingness_jobs, this, "miner");
+
+	define_scheme_primitive("cog-set-surprisingness-bootstrap!",
+		&MinerSCM::do_set_surprisingness_bootstrap, this, "miner");
+
+	define_scheme_primitive("cog-set-surprisingness-value-count-error!",
+		&MinerSCM::do_set_surprisingness_value_count_error, this, "miner");
+
+	define_scheme_primitive("cog-set-surprisingness-maximum-partitions!",
+		&MinerSCM::do_set_surprisingness_maximum_partitions, this, "miner");
+
+	define_scheme_primitive("cog-surprisingness-settings",
+		&MinerSCM::do_surprisingness_settings, this, "miner");
+
 	define_scheme_primitive("cog-miner-logger",
 		&MinerSCM::do_miner_logger, this, "miner");
 }
@@ -199,7 +435,8 @@ Handle MinerSCM::do_shallow_abstract(Handle pattern,
 	AtomSpace *as = SchemeSmob::ss_get_env_as("cog-shallow-abstract");
 
 	// Fetch data trees
-	HandleSeq db_seq = MinerUtils::get_db(db);
+	DbPtr db_ptr = get_db(db);
+	const HandleSeq& db_seq = *db_ptr;
 
 	// Fetch the minimum support
 	unsigned ms = MinerUtils::get_uint(ms_h);
@@ -216,7 +453,10 @@ Handle MinerSCM::do_shallow_abstract(Handle pattern,
 	for (const HandleSet& shabs : shabs_per_var) {
 		for (const Handle& sa : shabs) {
 			HandleSeq sa_list = vars.varseq;
-			sa_list[vari] = sa;
+			// Shallow abstractions use the same variable pool as
+			// pattern, alpha convert them to avoid collisions once
+			// substituted.
+			sa_list[vari] = MinerUtils::alpha_convert(sa, vars);
 			sa_lists.insert(sa_list.size() == 1 ? sa_list[0]
 			                // Only Wrap in a list if arity is greater
 			                // than one
@@ -236,7 +476,8 @@ Handle MinerSCM::do_shallow_specialize(Handle pattern,
 	AtomSpace *as = SchemeSmob::ss_get_env_as("cog-shallow-specialize");
 
 	// Fetch data trees
-	HandleSeq db_seq = MinerUtils::get_db(db);
+	DbPtr db_ptr = get_db(db);
+	const HandleSeq& db_seq = *db_ptr;
 
 	// Get minimum support and maximum number of variables
 	unsigned ms = MinerUtils::get_uint(ms_h);
@@ -248,10 +489,34 @@ Handle MinerSCM::do_shallow_specialize(Handle pattern,
 	return as->add_link(SET_LINK, HandleSeq(shaspes.begin(), shaspes.end()));
 }
 
+Handle MinerSCM::do_shallow_specialize_batch(Handle patterns,
+                                             Handle db,
+                                             Handle ms_h,
+                                             Handle mv_h)
+{
+	AtomSpace *as = SchemeSmob::ss_get_env_as("cog-shallow-specialize-batch");
+
+	// Fetch data trees
+	DbPtr db_ptr = get_db(db);
+	const HandleSeq& db_seq = *db_ptr;
+
+	// Get minimum support and maximum number of variables
+	unsigned ms = MinerUtils::get_uint(ms_h);
+	unsigned mv = MinerUtils::get_uint(mv_h);
+
+	// Generate all shallow specializations of all patterns
+	HandleSet shaspes =
+		MinerUtils::shallow_specialize_batch(patterns->getOutgoingSet(),
+		                                     db_seq, ms, mv, *as);
+
+	return as->add_link(SET_LINK, HandleSeq(shaspes.begin(), shaspes.end()));
+}
+
 bool MinerSCM::do_enough_support(Handle pattern, Handle db, Handle ms_h)
 {
 	// Fetch data trees
-	HandleSeq db_seq = MinerUtils::get_db(db);
+	DbPtr db_ptr = get_db(db);
+	const HandleSeq& db_seq = *db_ptr;
 
 	// Fetch the minimum support
 	unsigned ms = MinerUtils::get_uint(ms_h);
@@ -266,21 +531,140 @@ Handle MinerSCM::do_expand_conjunction(Handle cnjtion, Handle pattern,
 	AtomSpace *as = SchemeSmob::ss_get_env_as("cog-expand-conjunction");
 
 	// Fetch data trees
-	HandleSeq db_seq = MinerUtils::get_db(db);
+	DbPtr db_ptr = get_db(db);
+	const HandleSeq& db_seq = *db_ptr;
 
 	// Get minimum support and maximum variables
 	unsigned ms = MinerUtils::get_uint(ms_h);
 	unsigned mv = MinerUtils::get_uint(mv_h);
 
+	// Get the cache of infrequent patterns shared across calls
+	std::shared_ptr<InfrequentCache> ic =
+		get_infrequent_cache(db, db_ptr, ms);
+
 	HandleSet results = MinerUtils::expand_conjunction(cnjtion, pattern,
-	                                                   db_seq, ms, mv, es);
+	                                                   db_seq, ms, mv, es,
+	                                                   ic.get());
 	return as->add_link(SET_LINK, HandleSeq(results.begin(), results.end()));
 }
 
+Handle MinerSCM::do_expand_conjunction_batch(Handle pairs, Handle db,
+                                             Handle ms_h, Handle mv_h,
+                                             bool es)
+{
+	AtomSpace *as = SchemeSmob::ss_get_env_as("cog-expand-conjunction-batch");
+
+	// Fetch data trees
+	DbPtr db_ptr = get_db(db);
+	const HandleSeq& db_seq = *db_ptr;
+
+	// Get minimum support and maximum variables
+	unsigned ms = MinerUtils::get_uint(ms_h);
+	unsigned mv = MinerUtils::get_uint(mv_h);
+
+	// Get the cache of infrequent patterns shared across calls
+	std::shared_ptr<InfrequentCache> ic =
+		get_infrequent_cache(db, db_ptr, ms);
+
+	// Expand all pairs
+	std::vector<std::pair<Handle, Handle>> cp_pairs;
+	for (const Handle& pair : pairs->getOutgoingSet())
+		cp_pairs.emplace_back(pair->getOutgoingAtom(0), pair->getOutgoingAtom(1));
+	HandleSet results;
+	for (const HandleSet& pair_results :
+		     MinerUtils::expand_conjunction_batch(cp_pairs, db_seq, ms, mv,
+		                                          es, ic.get()))
+		results.insert(pair_results.begin(), pair_results.end());
+	return as->add_link(SET_LINK, HandleSeq(results.begin(), results.end()));
+}
+
+Handle MinerSCM::do_native_mine(Handle db, Handle ms, Handle initpat,
+                                Handle params)
+{
+	AtomSpace *as = SchemeSmob::ss_get_env_as("cog-native-mine");
+
+	// Fetch data trees
+	DbPtr db_ptr = get_db(db);
+	const HandleSeq& db_seq = *db_ptr;
+
+	// Mine and add the patterns to the atomspace
+	Miner miner(get_native_parameters(ms, initpat, params));
+	HandleSeq patterns;
+	for (const Handle& pattern : miner.native_mine(db_seq))
+		patterns.push_back(as->add_atom(pattern));
+	return as->add_link(SET_LINK, std::move(patterns));
+}
+
+Handle MinerSCM::do_native_mine_isurp(Handle db, Handle ms, Handle initpat,
+                                      Handle params, Handle db_ratio)
+{
+	return native_mine_isurp(db, ms, initpat, params, db_ratio, false);
+}
+
+Handle MinerSCM::do_native_mine_nisurp(Handle db, Handle ms, Handle initpat,
+                                       Handle params, Handle db_ratio)
+{
+	return native_mine_isurp(db, ms, initpat, params, db_ratio, true);
+}
+
+Handle MinerSCM::native_mine_isurp(Handle db, Handle ms, Handle initpat,
+                                   Handle params, Handle db_ratio,
+                                   bool normalize)
+{
+	AtomSpace *as = SchemeSmob::ss_get_env_as(normalize ? "cog-native-mine-nisurp"
+	                                          : "cog-native-mine-isurp");
+
+	// Fetch arguments
+	DbPtr db_ptr = get_db(db);
+	const HandleSeq& db_seq = *db_ptr;
+	double db_rat = MinerUtils::get_double(db_ratio);
+
+	// Mine and score the patterns
+	Miner miner(get_native_parameters(ms, initpat, params));
+	std::vector<std::pair<Handle, double>> scored =
+		Surprisingness::pipelined_isurp(miner, db_seq, *as, normalize, db_rat);
+
+	// Wrap them in evaluations
+	HandleSeq pats;
+	std::vector<double> isurps;
+	for (const auto& ps : scored) {
+		pats.push_back(ps.first);
+		isurps.push_back(ps.second);
+	}
+	return mk_surp_evals(as, normalize ? "nisurp" : "isurp", pats, isurps, db);
+}
+
+MinerParameters MinerSCM::get_native_parameters(Handle ms, Handle initpat,
+                                                Handle params)
+{
+	const HandleSeq& prms = params->getOutgoingSet();
+	OC_ASSERT(prms.size() == 11 or prms.size() == 14,
+	          "cog-native-mine expects 11 or 14 parameters");
+	MinerParameters param(MinerUtils::get_uint(ms), 1, initpat);
+	param.maxiter = (int)std::round(MinerUtils::get_double(prms[0]));
+	param.maxconjuncts = std::max(0, (int)std::round(MinerUtils::get_double(prms[1])));
+	param.maxvariables = MinerUtils::get_uint(prms[2]);
+	param.maxspcialconjuncts = MinerUtils::get_uint(prms[3]);
+	param.maxcnjexpvariables = MinerUtils::get_uint(prms[4]);
+	param.cnjexp = MinerUtils::get_double(prms[5]) != 0.0;
+	param.enfspec = MinerUtils::get_double(prms[6]) != 0.0;
+	param.maxtime = MinerUtils::get_double(prms[7]);
+	param.maxmemory = (size_t)std::max(0.0, MinerUtils::get_double(prms[8]));
+	param.closed = MinerUtils::get_double(prms[9]) != 0.0;
+	param.maximal = MinerUtils::get_double(prms[10]) != 0.0;
+	if (prms.size() == 14) {
+		param.checkpoint = prms[11]->get_name();
+		param.checkpoint_interval = MinerUtils::get_uint(prms[12]);
+		param.resume = MinerUtils::get_double(prms[13]) != 0.0;
+	}
+	return param;
+}
+
 double MinerSCM::do_isurp_old(Handle pattern, Handle db, Handle /*db_ratio*/)
 {
 	// Fetch data trees
-	HandleSeq db_seq = MinerUtils::get_db(db);
+	DbPtr db_ptr = get_db(db);
+	const HandleSeq& db_seq = *db_ptr;
 
 	return Surprisingness::isurp_old(pattern, db_seq, false);
 }
@@ -288,7 +672,8 @@ double MinerSCM::do_isurp_old(Handle pattern, Handle db, Handle /*db_ratio*/)
 double MinerSCM::do_nisurp_old(Handle pattern, Handle db, Handle /*db_ratio*/)
 {
 	// Fetch arguments
-	HandleSeq db_seq = MinerUtils::get_db(db);
+	DbPtr db_ptr = get_db(db);
+	const HandleSeq& db_seq = *db_ptr;
 
 	return Surprisingness::isurp_old(pattern, db_seq, true);
 }
@@ -296,7 +681,8 @@ double MinerSCM::do_nisurp_old(Handle pattern, Handle db, Handle /*db_ratio*/)
 double MinerSCM::do_isurp(Handle pattern, Handle db, Handle db_ratio)
 {
 	// Fetch arguments
-	HandleSeq db_seq = MinerUtils::get_db(db);
+	DbPtr db_ptr = get_db(db);
+	const HandleSeq& db_seq = *db_ptr;
 	double db_rat = MinerUtils::get_double(db_ratio);
 
 	return Surprisingness::isurp(pattern, db_seq, false, db_rat);
@@ -305,16 +691,109 @@ double MinerSCM::do_isurp(Handle pattern, Handle db, Handle db_ratio)
 double MinerSCM::do_nisurp(Handle pattern, Handle db, Handle db_ratio)
 {
 	// Fetch arguments
-	HandleSeq db_seq = MinerUtils::get_db(db);
+	DbPtr db_ptr = get_db(db);
+	const HandleSeq& db_seq = *db_ptr;
 	double db_rat = MinerUtils::get_double(db_ratio);
 
 	return Surprisingness::isurp(pattern, db_seq, true, db_rat);
 }
 
+Handle MinerSCM::do_isurp_batch(Handle patterns, Handle db, Handle db_ratio)
+{
+	return isurp_batch(patterns, db, db_ratio, false);
+}
+
+Handle MinerSCM::do_nisurp_batch(Handle patterns, Handle db, Handle db_ratio)
+{
+	return isurp_batch(patterns, db, db_ratio, true);
+}
+
+Handle MinerSCM::isurp_batch(Handle patterns, Handle db, Handle db_ratio,
+                             bool normalize)
+{
+	AtomSpace *as = SchemeSmob::ss_get_env_as(normalize ? "cog-nisurp-batch"
+	                                          : "cog-isurp-batch");
+
+	// Fetch arguments
+	DbPtr db_ptr = get_db(db);
+	const HandleSeq& db_seq = *db_ptr;
+	double db_rat = MinerUtils::get_double(db_ratio);
+	HandleSeq pats;
+	for (const Handle& pattern : patterns->getOutgoingSet())
+		if (1 < MinerUtils::n_conjuncts(pattern))
+			pats.push_back(pattern);
+
+	// Calculate the I-Surprisingness of all patterns
+	std::vector<double> isurps =
+		Surprisingness::isurp_batch(pats, db_seq, normalize, db_rat);
+
+	// Wrap them in evaluations
+	return mk_surp_evals(as, normalize ? "nisurp" : "isurp", pats, isurps, db);
+}
+
+Handle MinerSCM::do_isurp_top_k(Handle patterns, Handle db, Handle k,
+                                Handle db_ratio)
+{
+	return isurp_top_k(patterns, db, k, db_ratio, false);
+}
+
+Handle MinerSCM::do_nisurp_top_k(Handle patterns, Handle db, Handle k,
+                                 Handle db_ratio)
+{
+	return isurp_top_k(patterns, db, k, db_ratio, true);
+}
+
+Handle MinerSCM::isurp_top_k(Handle patterns, Handle db, Handle k,
+                             Handle db_ratio, bool normalize)
+{
+	AtomSpace *as = SchemeSmob::ss_get_env_as(normalize ? "cog-nisurp-top-k"
+	                                          : "cog-isurp-top-k");
+
+	// Fetch arguments
+	DbPtr db_ptr = get_db(db);
+	const HandleSeq& db_seq = *db_ptr;
+	unsigned k_val = MinerUtils::get_uint(k);
+	double db_rat = MinerUtils::get_double(db_ratio);
+	HandleSeq pats;
+	for (const Handle& pattern : patterns->getOutgoingSet())
+		if (1 < MinerUtils::n_conjuncts(pattern))
+			pats.push_back(pattern);
+
+	// Calculate the I-Surprisingness of the top k patterns
+	std::vector<std::pair<Handle, double>> top =
+		Surprisingness::isurp_top_k(pats, db_seq, k_val, normalize, db_rat);
+
+	// Wrap them in evaluations
+	HandleSeq top_pats;
+	std::vector<double> isurps;
+	for (const auto& ps : top) {
+		top_pats.push_back(ps.first);
+		isurps.push_back(ps.second);
+	}
+	return mk_surp_evals(as, normalize ? "nisurp" : "isurp", top_pats, isurps, db);
+}
+
+Handle MinerSCM::mk_surp_evals(AtomSpace* as, const std::string& pred_name,
+                               const HandleSeq& patterns,
+                               const std::vector<double>& scores,
+                               const Handle& db)
+{
+	Handle pred = as->add_node(PREDICATE_NODE, std::string(pred_name));
+	HandleSeq evals;
+	for (size_t i = 0; i < patterns.size(); i++) {
+		Handle eval = as->add_link(EVALUATION_LINK, pred,
+		                           as->add_link(LIST_LINK, patterns[i], db));
+		eval->setTruthValue(createSimpleTruthValue(scores[i], 1.0));
+		evals.push_back(eval);
+	}
+	return as->add_link(SET_LINK, std::move(evals));
+}
+
 TruthValuePtr MinerSCM::do_emp_tv(Handle pattern, Handle db, Handle db_ratio)
 {
 	// Fetch arguments
-	HandleSeq db_seq = MinerUtils::get_db(db);
+	DbPtr db_ptr = get_db(db);
+	const HandleSeq& db_seq = *db_ptr;
 	double db_rat = MinerUtils::get_double(db_ratio);
 
 	// Calculate its estimate first to optimize empirical calculation
@@ -325,7 +804,8 @@ TruthValuePtr MinerSCM::do_emp_tv(Handle pattern, Handle db, Handle db_ratio)
 TruthValuePtr MinerSCM::do_ji_tv_est(Handle pattern, Handle db)
 {
 	// Fetch data trees
-	HandleSeq db_seq = MinerUtils::get_db(db);
+	DbPtr db_ptr = get_db(db);
+	const HandleSeq& db_seq = *db_ptr;
 
 	return Surprisingness::ji_tv_est_mem(pattern, db_seq);
 }
@@ -335,11 +815,121 @@ double MinerSCM::do_jsd(TruthValuePtr ltv, TruthValuePtr rtv)
 	return Surprisingness::jsd(ltv, rtv);
 }
 
+void MinerSCM::do_set_surprisingness_jobs(Handle jobs)
+{
+	Surprisingness::set_jobs(MinerUtils::get_uint(jobs));
+}
+
+void MinerSCM::do_set_surprisingness_bootstrap(Handle tolerance,
+                                                Handle max_resamples)
+{
+	Surprisingness::set_bootstrap_tolerance(MinerUtils::get_double(tolerance));
+	Surprisingness::set_maximum_resamples(MinerUtils::get_uint(max_resamples));
+}
+
+void MinerSCM::do_set_surprisingness_value_count_error(Handle error)
+{
+	Surprisingness::set_value_count_error(MinerUtils::get_double(error));
+}
+
+void MinerSCM::do_set_surprisingness_maximum_partitions(Handle max_prtns)
+{
+	Surprisingness::set_maximum_partitions(MinerUtils::get_uint(max_prtns));
+}
+
+Handle MinerSCM::do_surprisingness_settings()
+{
+	AtomSpace *as = SchemeSmob::ss_get_env_as("cog-surprisingness-settings");
+	auto number = [&](double x) { return as->add_atom(createNumberNode(x)); };
+	HandleSeq settings{number(Surprisingness::get_jobs()),
+	                   number(Surprisingness::get_bootstrap_tolerance()),
+	                   number(Surprisingness::get_maximum_resamples()),
+	                   number(Surprisingness::get_value_count_error()),
+	                   number(Surprisingness::get_maximum_partitions())};
+	return as->add_link(LIST_LINK, std::move(settings));
+}
+
 Logger* MinerSCM::do_miner_logger()
 {
 	return &miner_logger();
 }
 
+std::shared_ptr<InfrequentCache> MinerSCM::get_infrequent_cache(const Handle& db,
+                                                                const DbPtr& db_ptr,
+                                                                unsigned ms)
+{
+	std::lock_guard<std::mutex> lock(_infrequent_caches_mutex);
+
+	auto it = _infrequent_caches.find({db, ms});
+	if (it != _infrequent_caches.end() and it->second.db.lock() == db_ptr) {
+		it->second.last_use = ++_infrequent_cache_uses;
+		return it->second.cache;
+	}
+
+	// Discard the caches of discarded snapshots, then the least
+	// recently used ones if there are still too many
+	for (auto cit = _infrequent_caches.begin(); cit != _infrequent_caches.end();)
+		if (cit->second.db.expired())
+			cit = _infrequent_caches.erase(cit);
+		else
+			++cit;
+	while (max_infrequent_caches <= _infrequent_caches.size())
+		_infrequent_caches.erase(std::min_element(
+			_infrequent_caches.begin(), _infrequent_caches.end(),
+			[](const auto& l, const auto& r) {
+				return l.second.last_use < r.second.last_use; }));
+
+	DbInfrequentCache& dic = _infrequent_caches[{db, ms}];
+	dic = {db_ptr, std::make_shared<InfrequentCache>(),
+	       ++_infrequent_cache_uses};
+	return dic.cache;
+}
+
+MinerSCM::DbPtr MinerSCM::get_db(const Handle& db)
+{
+	// Hashing member links is cheaper than collecting the members and
+	// copying them. The hash is independent of their order.
+	size_t members_hash = 0;
+	IncomingSet member_links = db->getIncomingSetByType(MEMBER_LINK);
+	for (const Handle& l : member_links)
+		members_hash += l->get_hash();
+	boost::hash_combine(members_hash, member_links.size());
+
+	std::lock_guard<std::mutex> lock(_dbs_mutex);
+	auto it = _dbs.find(db);
+	if (it != _dbs.end() and it->second.members_hash == members_hash) {
+		it->second.last_use = ++_db_uses;
+		return it->second.db;
+	}
+
+	// Discard the snapshots of db concepts that have been removed
+	// from their atomspace, such as temporary ones created by
+	// cog-mine, then the least recently used ones if there are still
+	// too many
+	if (it != _dbs.end())
+		_dbs.erase(it);
+	for (auto dit = _dbs.begin(); dit != _dbs.end();)
+		if (dit->first->getAtomSpace() == nullptr)
+			dit = _dbs.erase(dit);
+		else
+			++dit;
+	while (max_dbs <= _dbs.size())
+		_dbs.erase(std::min_element(_dbs.begin(), _dbs.end(),
+		                            [](const auto& l, const auto& r) {
+			                            return l.second.last_use
+				                            < r.second.last_use; }));
+
+	// The snapshot shares its copy for support calculations, till
+	// it is discarded and no longer in use
+	HandleSeq* members = new HandleSeq(MinerUtils::get_db(db));
+	MinerUtils::share_db_copy(*members);
+	DbPtr db_seq(members, [](const HandleSeq* hs) {
+			MinerUtils::release_db_copy(*hs);
+			delete hs; });
+	_dbs[db] = {members_hash, db_seq, ++_db_uses};
+	return db_seq;
+}
+
 extern "C" {
 void opencog_miner_init(void);
 };
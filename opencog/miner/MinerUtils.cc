@@ -22,6 +22,7 @@
  */
 
 #include "MinerUtils.h"
+#include "InfrequentCache.h"
 
 #include <opencog/util/dorepeat.h>
 #include <opencog/util/random.h>
@@ -50,6 +51,18 @@
 #include <boost/numeric/conversion/cast.hpp>
 #include <boost/algorithm/cxx11/all_of.hpp>
 #include <boost/algorithm/cxx11/any_of.hpp>
+#include <boost/functional/hash.hpp>
+
+#include <atomic>
+#include <cmath>
+#include <exception>
+#include <fstream>
+#include <mutex>
+#include <numeric>
+#include <set>
+#include <thread>
+
+#include <unistd.h>
 
 namespace opencog
 {
@@ -215,7 +228,7 @@ Handle MinerUtils::shallow_abstract_of_val(const Handle& value)
 		return value;
 
 	Type tt = value->get_type();
-	HandleSeq rnd_vars = gen_rand_variables(value->get_arity());
+	HandleSeq rnd_vars = gen_variables(value->get_arity());
 	Handle vardecl = variable_set(rnd_vars);
 
 	// TODO: this can probably be simplified using PresentLink, would
@@ -289,11 +302,108 @@ Handle MinerUtils::local_quote(const Handle& h)
 
 Handle MinerUtils::compose(const Handle& pattern, const HandleMap& var2pat)
 {
-	if (RewriteLinkPtr sc = RewriteLinkCast(pattern))
-		return remove_useless_clauses(sc->beta_reduce(var2pat));
+	if (RewriteLinkPtr sc = RewriteLinkCast(pattern)) {
+		// Variables are taken from a deterministic pool, thus
+		// sub-patterns are likely to share variables with pattern,
+		// alpha convert them to avoid collisions.
+		Variables used = sc->get_variables();
+		HandleMap avar2pat;
+		for (const auto& vp : var2pat) {
+			Handle apat = alpha_convert(vp.second, used);
+			used.extend(get_variables(apat));
+			avar2pat[vp.first] = apat;
+		}
+
+		Handle npat = fast_compose(pattern, avar2pat);
+		if (not npat)
+			npat = remove_useless_clauses(sc->beta_reduce(avar2pat));
+		return canonical_rename(npat);
+	}
 	return pattern;
 }
 
+Handle MinerUtils::fast_compose(const Handle& pattern, const HandleMap& var2pat)
+{
+	const Variables& vars = get_variables(pattern);
+
+	// Typed variables require type checking, leave that to beta_reduce
+	if (not vars._typemap.empty())
+		return Handle::UNDEFINED;
+
+	// Build the new variable sequence and the substitution of the
+	// body in a single pass over the variables of pattern.
+	HandleSeq nvarseq;
+	HandleSet nvarset;
+	HandleMap var2body;
+	auto add_var = [&](const Handle& var) {
+		if (nvarset.insert(var).second)
+			nvarseq.push_back(var);
+	};
+	for (const Handle& var : vars.varseq) {
+		auto it = var2pat.find(var);
+		if (it == var2pat.end()) {
+			add_var(var);
+			continue;
+		}
+		const Handle& val = it->second;
+		Type vt = val->get_type();
+		if (vt == VARIABLE_NODE) {
+			// Variable factorization, var is replaced by val. Since
+			// the substitution is simultaneous, val remains a
+			// variable even if it is itself remapped, as with
+			// {X->Y, Y->Z}, so it is added here rather than when its
+			// own turn comes.
+			if (val != var)
+				var2body[var] = val;
+			add_var(val);
+		} else if (vt == LAMBDA_LINK) {
+			const Variables& vvars = get_variables(val);
+			const Handle& vbody = get_body(val);
+			Type vbt = vbody->get_type();
+			// Quotations and conjunctions need to be consumed or
+			// flattened, and typed or colliding variables need
+			// alpha-conversion, leave these cases to beta_reduce.
+			if (not vvars._typemap.empty() or
+			    vbt == LOCAL_QUOTE_LINK or vbt == QUOTE_LINK or
+			    vbt == AND_LINK or vbt == PRESENT_LINK)
+				return Handle::UNDEFINED;
+			for (const Handle& vv : vvars.varseq) {
+				if (vars.is_in_varset(vv) or nvarset.find(vv) != nvarset.end())
+					return Handle::UNDEFINED;
+				add_var(vv);
+			}
+			var2body[var] = vbody;
+		} else if (is_nullary(val)) {
+			// Constant
+			var2body[var] = val;
+		} else {
+			return Handle::UNDEFINED;
+		}
+	}
+
+	// A constant pattern is left to beta_reduce as well
+	if (nvarseq.empty())
+		return Handle::UNDEFINED;
+
+	// Substitute and simplify the clauses before building any atom
+	// for the new pattern
+	Handle nbody = vars.substitute_nocheck(get_body(pattern), var2body);
+	HandleSeq clauses = get_clauses_of_body(nbody);
+	remove_useless_clauses(nvarset, clauses);
+	if (clauses.empty())
+		return Handle::UNDEFINED;
+
+	// Only keep variables still present in the remaining clauses
+	HandleSeq fvarseq;
+	for (const Handle& var : nvarseq)
+		if (is_free_in_any_tree(clauses, var))
+			fvarseq.push_back(var);
+	if (fvarseq.empty())
+		return Handle::UNDEFINED;
+
+	return mk_pattern(variable_set(fvarseq), clauses);
+}
+
 HandleSeq MinerUtils::get_db(const Handle& db_cpt)
 {
 	// Retrieve all members of db_cpt
@@ -317,6 +427,58 @@ double MinerUtils::get_double(const Handle& h)
 	return NumberNodeCast(h)->get_value();
 }
 
+// Copy of a db in its own atomspace, so that the pattern matcher only
+// runs over the db
+struct DbCopy
+{
+	AtomSpace as;
+	HandleSeq db;
+	unsigned shares = 0;
+};
+typedef std::shared_ptr<DbCopy> DbCopyPtr;
+
+// Shared copies, identified by the address and size of their db
+typedef std::pair<const Handle*, size_t> DbKey;
+static std::map<DbKey, DbCopyPtr> db_copies;
+static std::mutex db_copies_mtx;
+
+static DbCopyPtr mk_db_copy(const HandleSeq& db)
+{
+	DbCopyPtr dbc = std::make_shared<DbCopy>();
+	for (const Handle& dt : db)
+		dbc->db.push_back(dbc->as.add_atom(dt));
+	return dbc;
+}
+
+// Return the shared copy of db if any, a new copy otherwise
+static DbCopyPtr db_copy(const HandleSeq& db)
+{
+	{
+		std::lock_guard<std::mutex> lock(db_copies_mtx);
+		auto it = db_copies.find({db.data(), db.size()});
+		if (it != db_copies.end())
+			return it->second;
+	}
+	return mk_db_copy(db);
+}
+
+void MinerUtils::share_db_copy(const HandleSeq& db)
+{
+	std::lock_guard<std::mutex> lock(db_copies_mtx);
+	DbCopyPtr& dbc = db_copies[{db.data(), db.size()}];
+	if (not dbc)
+		dbc = mk_db_copy(db);
+	dbc->shares++;
+}
+
+void MinerUtils::release_db_copy(const HandleSeq& db)
+{
+	std::lock_guard<std::mutex> lock(db_copies_mtx);
+	auto it = db_copies.find({db.data(), db.size()});
+	if (it != db_copies.end() and --it->second->shares == 0)
+		db_copies.erase(it);
+}
+
 unsigned MinerUtils::support(const Handle& pattern,
                              const HandleSeq& db,
                              unsigned ms)
@@ -338,6 +500,33 @@ unsigned MinerUtils::support(const Handle& pattern,
 	return boost::accumulate(freqs, 1, std::multiplies<unsigned>());
 }
 
+unsigned MinerUtils::support(const Handle& pattern,
+                             const HandleSeq& db,
+                             const std::vector<unsigned>& indices,
+                             unsigned ms)
+{
+	// Partition the pattern into strongly connected components
+	HandleSeq cps(get_component_patterns(pattern));
+
+	// Likely a constant pattern
+	if (cps.empty())
+	    return 1;
+
+	// Load the selected data trees once for all components, in a
+	// temporary atomspace per thread
+	static thread_local AtomSpace tmp_db_as;
+	tmp_db_as.clear();
+	for (unsigned i : indices)
+		tmp_db_as.add_atom(db[i]);
+
+	// Calculate the product of the frequencies of all components
+	unsigned sup = 1;
+	for (const Handle& cp : cps)
+		sup *= totally_abstract(cp) ? indices.size() :
+			restricted_satisfying_set(cp, tmp_db_as, {}, ms)->get_arity();
+	return sup;
+}
+
 unsigned MinerUtils::component_support(const Handle& component,
                                        const HandleSeq& db,
                                        unsigned ms)
@@ -347,6 +536,38 @@ unsigned MinerUtils::component_support(const Handle& component,
 	return restricted_satisfying_set(component, db, ms)->get_arity();
 }
 
+std::vector<unsigned> MinerUtils::batch_support(const HandleSeq& patterns,
+                                                const HandleSeq& db,
+                                                unsigned ms)
+{
+	std::vector<unsigned> sups;
+	if (patterns.empty())
+		return sups;
+
+	// Load the db once for all patterns, if not already shared
+	DbCopyPtr dbc = db_copy(db);
+	AtomSpace& db_as = dbc->as;
+	const HandleSeq& as_db = dbc->db;
+
+	// Supports of components, shared across patterns, as candidates
+	// obtained from the same pattern often have components in common.
+	std::map<Handle, unsigned> comp_sups;
+	for (const Handle& pattern : patterns) {
+		unsigned sup = 1;
+		for (const Handle& cp : get_component_patterns(pattern)) {
+			auto it = comp_sups.find(cp);
+			if (it == comp_sups.end()) {
+				unsigned cs = totally_abstract(cp) ? db.size() :
+					restricted_satisfying_set(cp, db_as, as_db, ms)->get_arity();
+				it = comp_sups.emplace(cp, cs).first;
+			}
+			sup *= it->second;
+		}
+		sups.push_back(sup);
+	}
+	return sups;
+}
+
 bool MinerUtils::enough_support(const Handle& pattern,
                                 const HandleSeq& db,
                                 unsigned ms)
@@ -393,6 +614,137 @@ HandleSet MinerUtils::shallow_specialize(const Handle& pattern,
 	return results;
 }
 
+// Rebuild h replacing its subtrees by their images through rpl, if
+// defined
+static Handle replace_subtrees(const Handle& h,
+                               const std::function<Handle(const Handle&)>& rpl)
+{
+	Handle r = rpl(h);
+	if (r)
+		return r;
+	if (h->is_node())
+		return h;
+	HandleSeq outgoings;
+	bool changed = false;
+	for (const Handle& ch : h->getOutgoingSet()) {
+		outgoings.push_back(replace_subtrees(ch, rpl));
+		changed |= outgoings.back() != ch;
+	}
+	return changed ? createLink(std::move(outgoings), h->get_type()) : h;
+}
+
+HandleSeq MinerUtils::shallow_generalizations(const Handle& pattern)
+{
+	const Variables& vars = get_variables(pattern);
+	if (pattern->get_type() != LAMBDA_LINK or not vars._typemap.empty())
+		return {};
+	HandleSeq clauses = get_clauses(pattern);
+
+	// Count variable occurrences, collect constants and links of
+	// variables, and give up on quotations
+	std::map<Handle, unsigned> var_counts;
+	HandleSet constants, var_links;
+	bool quoted = false;
+	std::function<void(const Handle&)> visit = [&](const Handle& h) {
+		Type t = h->get_type();
+		if (t == QUOTE_LINK or t == LOCAL_QUOTE_LINK or t == UNQUOTE_LINK) {
+			quoted = true;
+			return;
+		}
+		if (h->is_node()) {
+			if (vars.is_in_varset(h))
+				var_counts[h]++;
+			else
+				constants.insert(h);
+			return;
+		}
+		if (0 < h->get_arity()
+		    and boost::algorithm::all_of(h->getOutgoingSet(),
+		                                 [&](const Handle& ch) {
+			                                 return vars.is_in_varset(ch); }))
+			var_links.insert(h);
+		for (const Handle& ch : h->getOutgoingSet())
+			visit(ch);
+	};
+	for (const Handle& clause : clauses)
+		visit(clause);
+	if (quoted)
+		return {};
+
+	// New variable, not colliding with the variables of pattern
+	Handle nvar;
+	for (size_t i = 0; not nvar; i++)
+		if (not vars.is_in_varset(gen_variable(i)))
+			nvar = gen_variable(i);
+
+	HandleSeq gens;
+	auto add_gen = [&](const std::function<Handle(const Handle&)>& rpl) {
+		HandleSeq nclauses;
+		for (const Handle& clause : clauses)
+			nclauses.push_back(replace_subtrees(clause, rpl));
+		HandleSet nvars;
+		for (const Handle& clause : nclauses) {
+			HandleSet cvars = get_free_variables(clause);
+			nvars.insert(cvars.begin(), cvars.end());
+		}
+		remove_useless_clauses(nvars, nclauses);
+		if (not nclauses.empty())
+			gens.push_back(mk_pattern(variable_set(HandleSeq(nvars.begin(),
+			                                                 nvars.end())),
+			                          nclauses));
+	};
+
+	// 1. Constants
+	for (const Handle& c : constants)
+		add_gen([&](const Handle& h) {
+				return h == c ? nvar : Handle::UNDEFINED; });
+
+	// 2. Links of distinct variables occurring nowhere else
+	for (const Handle& l : var_links) {
+		HandleSet lvars(l->getOutgoingSet().begin(), l->getOutgoingSet().end());
+		if (lvars.size() != l->get_arity()
+		    or not boost::algorithm::all_of(lvars, [&](const Handle& v) {
+				    return var_counts[v] == 1; }))
+			continue;
+		add_gen([&](const Handle& h) {
+				return h == l ? nvar : Handle::UNDEFINED; });
+	}
+
+	// 3. One occurrence of a variable occurring multiple times
+	for (const auto& vc : var_counts) {
+		if (vc.second < 2)
+			continue;
+		for (unsigned k = 0; k < vc.second; k++) {
+			unsigned occurrence = 0;
+			add_gen([&](const Handle& h) {
+					if (h != vc.first)
+						return Handle::UNDEFINED;
+					return occurrence++ == k ? nvar : h; });
+		}
+	}
+	return gens;
+}
+
+HandleSet MinerUtils::shallow_specialize_batch(const HandleSeq& patterns,
+                                               const HandleSeq& db,
+                                               unsigned ms,
+                                               unsigned mv,
+                                               AtomSpace& as)
+{
+	HandleSet specialized, results;
+	for (const Handle& pattern : patterns) {
+		if (not specialized.insert(as.add_atom(pattern)).second)
+			continue;
+		for (const Handle& npat : shallow_specialize(pattern, db, ms, mv)) {
+			Handle anpat = as.add_atom(npat);
+			if (get_support(anpat) < 0)
+				set_support(anpat, get_support(npat));
+			results.insert(anpat);
+		}
+	}
+	return results;
+}
+
 Handle MinerUtils::mk_body(const HandleSeq clauses)
 {
 	if (clauses.size() == 0)
@@ -471,25 +823,28 @@ Handle MinerUtils::restricted_satisfying_set(const Handle& pattern,
                                              const HandleSeq& db,
                                              unsigned ms)
 {
-	static AtomSpace tmp_db_as; // TODO: fix to be thread safe
-	tmp_db_as.clear();
-	HandleSeq tmp_db;
-	for (const auto& dt : db)
-		tmp_db.push_back(tmp_db_as.add_atom(dt));
+	DbCopyPtr dbc = db_copy(db);
+	return restricted_satisfying_set(pattern, dbc->as, dbc->db, ms);
+}
 
+Handle MinerUtils::restricted_satisfying_set(const Handle& pattern,
+                                             AtomSpace& db_as,
+                                             const HandleSeq& db,
+                                             unsigned ms)
+{
 	// Avoid pattern matcher warning
 	if (totally_abstract(pattern) and n_conjuncts(pattern) == 1)
-		return tmp_db_as.add_link(SET_LINK, std::move(tmp_db));
+		return Handle(createUnorderedLink(HandleSeq(db), SET_LINK));
 
 	// Define pattern to run
-	AtomSpace tmp_query_as(&tmp_db_as);
+	AtomSpace tmp_query_as(&db_as);
 	Handle tmp_pattern = tmp_query_as.add_atom(pattern),
 		vardecl = get_vardecl(tmp_pattern),
 		body = get_body(tmp_pattern),
 		gl = tmp_query_as.add_link(GET_LINK, vardecl, body);
 
 	// Run pattern matcher
-	SatisfyingSet sater(&tmp_db_as);
+	SatisfyingSet sater(&db_as);
 	sater.max_results = ms;
 	sater.satisfy(PatternLinkCast(gl));
 
@@ -498,6 +853,53 @@ Handle MinerUtils::restricted_satisfying_set(const Handle& pattern,
 	return Handle(createUnorderedLink(std::move(hs), SET_LINK));
 }
 
+// Satisfying set passing each grounding to a callback rather than
+// queuing it
+class GroundingStream : public SatisfyingSet
+{
+public:
+	GroundingStream(AtomSpace* as,
+	                const std::function<void(const HandleSeq&)>& on_grounding)
+		: SatisfyingSet(as), _on_grounding(on_grounding) {}
+
+	bool grounding(const GroundingMap& var_soln,
+	               const GroundingMap& term_soln) override
+	{
+		HandleSeq values;
+		for (const Handle& var : _varseq)
+			values.push_back(var_soln.at(var));
+		_on_grounding(values);
+		return false;
+	}
+
+private:
+	const std::function<void(const HandleSeq&)>& _on_grounding;
+};
+
+void MinerUtils::for_each_grounding(const Handle& pattern,
+                                    const HandleSeq& db,
+                                    const std::function<void(const HandleSeq&)>& on_grounding)
+{
+	// Avoid pattern matcher warning
+	if (totally_abstract(pattern) and n_conjuncts(pattern) == 1) {
+		for (const Handle& dt : db)
+			on_grounding({dt});
+		return;
+	}
+
+	// Define pattern to run
+	DbCopyPtr dbc = db_copy(db);
+	AtomSpace tmp_query_as(&dbc->as);
+	Handle tmp_pattern = tmp_query_as.add_atom(pattern),
+		vardecl = get_vardecl(tmp_pattern),
+		body = get_body(tmp_pattern),
+		gl = tmp_query_as.add_link(GET_LINK, vardecl, body);
+
+	// Run pattern matcher
+	GroundingStream gs(&dbc->as, on_grounding);
+	gs.satisfy(PatternLinkCast(gl));
+}
+
 bool MinerUtils::totally_abstract(const Handle& pattern)
 {
 	// Check whether it is an abstraction to begin with
@@ -523,6 +925,238 @@ bool MinerUtils::totally_abstract(const Handle& pattern)
 	return true;
 }
 
+HandleSeq MinerUtils::gen_variables(size_t n)
+{
+	HandleSeq variables;
+	for (size_t i = 0; i < n; i++)
+		variables.push_back(gen_variable(i));
+	return variables;
+}
+
+Handle MinerUtils::gen_variable(size_t i)
+{
+	// Each thread reads from its own copy of the pool, so that the
+	// shared pool, and its mutex, are only accessed when the pool
+	// grows, while all threads still get the same variables.
+	thread_local HandleSeq local_pool;
+	if (i < local_pool.size())
+		return local_pool[i];
+
+	static std::mutex mtx;
+	static HandleSeq pool;
+
+	std::lock_guard<std::mutex> lock(mtx);
+	while (pool.size() <= i)
+		pool.push_back(createNode(VARIABLE_NODE,
+		                          "$PM-" + std::to_string(pool.size())));
+	local_pool = pool;
+	return local_pool[i];
+}
+
+/**
+ * Hash of h where each variable in colours is replaced by its colour,
+ * ignoring the order of the outgoings of unordered links.
+ */
+static size_t coloured_hash(const Handle& h,
+                            const std::map<Handle, size_t>& colours)
+{
+	if (h->is_node()) {
+		auto it = colours.find(h);
+		if (it == colours.end())
+			return h->get_hash();
+		size_t seed = std::hash<Type>()(VARIABLE_NODE);
+		boost::hash_combine(seed, it->second);
+		return seed;
+	}
+
+	Type t = h->get_type();
+	size_t seed = std::hash<Type>()(t);
+	if (nameserver().isA(t, UNORDERED_LINK)) {
+		size_t sum = 0;
+		for (const Handle& ch : h->getOutgoingSet())
+			sum += coloured_hash(ch, colours);
+		boost::hash_combine(seed, sum);
+	} else {
+		for (const Handle& ch : h->getOutgoingSet())
+			boost::hash_combine(seed, coloured_hash(ch, colours));
+	}
+	return seed;
+}
+
+static size_t count_colours(const std::map<Handle, size_t>& colours)
+{
+	std::set<size_t> distinct;
+	for (const auto& vc : colours)
+		distinct.insert(vc.second);
+	return distinct.size();
+}
+
+/**
+ * Refine the colours of the variables, by the colours of the clauses
+ * they occur in and their positions in these clauses, till the
+ * partition of the variables they induce is stable.
+ */
+static void refine_colours(const HandleSeq& clauses,
+                           std::map<Handle, size_t>& colours)
+{
+	size_t n_colours = count_colours(colours);
+	while (n_colours < colours.size()) {
+		std::map<Handle, size_t> ncolours;
+		for (const auto& vc : colours) {
+			// Mark the variable so that its positions are accounted for
+			std::map<Handle, size_t> marked(colours);
+			boost::hash_combine(marked[vc.first], 1);
+			std::vector<size_t> occs;
+			for (const Handle& clause : clauses)
+				if (is_free_in_tree(clause, vc.first))
+					occs.push_back(coloured_hash(clause, marked));
+			std::sort(occs.begin(), occs.end());
+			size_t seed = vc.second;
+			for (size_t occ : occs)
+				boost::hash_combine(seed, occ);
+			ncolours[vc.first] = seed;
+		}
+		size_t nn_colours = count_colours(ncolours);
+		if (nn_colours == n_colours)
+			break;
+		colours = ncolours;
+		n_colours = nn_colours;
+	}
+}
+
+Handle MinerUtils::canonical_rename(const Handle& pattern)
+{
+	const Variables& vars = get_variables(pattern);
+	if (vars.varseq.empty() or not vars._typemap.empty())
+		return pattern;
+
+	Handle body = get_body(pattern);
+	HandleSeq clauses = get_clauses(pattern);
+
+	// Colour the variables occurring in the body, initially all alike
+	std::map<Handle, size_t> init_colours;
+	for (const Handle& var : vars.varseq)
+		if (is_free_in_any_tree(clauses, var))
+			init_colours[var] = 0;
+
+	// Rename variables by order of first occurrence, visiting clauses
+	// by order of colouring, which, if every variable has a distinct
+	// colour, does not depend on their names.
+	auto rename_discrete = [&](const std::map<Handle, size_t>& dcolours,
+	                           HandleMap& rnm, HandleSeq& nvarseq) {
+		std::vector<std::pair<size_t, Handle>> coloured_clauses;
+		for (const Handle& clause : clauses)
+			coloured_clauses.emplace_back(coloured_hash(clause, dcolours),
+			                              clause);
+		std::stable_sort(coloured_clauses.begin(), coloured_clauses.end(),
+		                 [](const std::pair<size_t, Handle>& l,
+		                    const std::pair<size_t, Handle>& r) {
+			                 return l.first < r.first; });
+		std::function<void(const Handle&)> visit = [&](const Handle& h) {
+			if (h->is_node()) {
+				if (dcolours.find(h) != dcolours.end()
+				    and rnm.find(h) == rnm.end()) {
+					Handle nvar = gen_variable(nvarseq.size());
+					rnm[h] = nvar;
+					nvarseq.push_back(nvar);
+				}
+				return;
+			}
+			// Visit outgoings of unordered links by order of colouring
+			HandleSeq outs(h->getOutgoingSet());
+			if (nameserver().isA(h->get_type(), UNORDERED_LINK))
+				std::stable_sort(outs.begin(), outs.end(),
+				                 [&](const Handle& l, const Handle& r) {
+					                 return coloured_hash(l, dcolours)
+						                 < coloured_hash(r, dcolours); });
+			for (const Handle& ch : outs)
+				visit(ch);
+		};
+		for (const auto& cc : coloured_clauses)
+			visit(cc.second);
+	};
+
+	// Refine the colours, and as long as some variables share the
+	// same colour, individualize each of them in turn, keeping the
+	// renaming leading to the smallest body. Symmetric patterns may
+	// have many such renamings, all equivalent, thus the exploration
+	// is bounded.
+	static const unsigned max_leaves = 1024;
+	unsigned leaves = 0;
+	HandleMap best_rnm;
+	HandleSeq best_nvarseq;
+	std::string best_str;
+	std::function<void(std::map<Handle, size_t>)> search =
+		[&](std::map<Handle, size_t> colours) {
+		if (max_leaves <= leaves)
+			return;
+		refine_colours(clauses, colours);
+		std::map<size_t, HandleSeq> classes;
+		for (const auto& vc : colours)
+			classes[vc.second].push_back(vc.first);
+		auto tied = std::find_if(classes.begin(), classes.end(),
+		                         [](const auto& cl) {
+			                         return 1 < cl.second.size(); });
+		if (tied != classes.end()) {
+			for (const Handle& var : tied->second) {
+				std::map<Handle, size_t> icolours(colours);
+				boost::hash_combine(icolours[var], 1);
+				search(icolours);
+			}
+			return;
+		}
+		leaves++;
+		HandleMap rnm;
+		HandleSeq nvarseq;
+		rename_discrete(colours, rnm, nvarseq);
+		std::string str = vars.substitute_nocheck(body, rnm)->to_string();
+		if (best_nvarseq.empty() or str < best_str) {
+			best_rnm = rnm;
+			best_nvarseq = nvarseq;
+			best_str = str;
+		}
+	};
+	search(init_colours);
+
+	// Variables absent from the body, if any, come last
+	for (const Handle& var : vars.varseq) {
+		if (best_rnm.find(var) == best_rnm.end()) {
+			Handle nvar = gen_variable(best_nvarseq.size());
+			best_rnm[var] = nvar;
+			best_nvarseq.push_back(nvar);
+		}
+	}
+
+	// Already canonical
+	if (best_nvarseq == vars.varseq)
+		return pattern;
+
+	Handle nbody = vars.substitute_nocheck(body, best_rnm);
+	return Handle(createLambdaLink(variable_set(best_nvarseq), nbody));
+}
+
+size_t MinerUtils::shape_hash(const Handle& h, const HandleSet& vars)
+{
+	if (h->is_node())
+		return vars.find(h) != vars.end() ?
+			std::hash<Type>()(VARIABLE_NODE) : h->get_hash();
+
+	Type t = h->get_type();
+	size_t seed = std::hash<Type>()(t);
+	if (nameserver().isA(t, UNORDERED_LINK)) {
+		// Order of the outgoings is irrelevant and may depend on
+		// variable names
+		size_t sum = 0;
+		for (const Handle& ch : h->getOutgoingSet())
+			sum += shape_hash(ch, vars);
+		boost::hash_combine(seed, sum);
+	} else {
+		for (const Handle& ch : h->getOutgoingSet())
+			boost::hash_combine(seed, shape_hash(ch, vars));
+	}
+	return seed;
+}
+
 HandleSeq MinerUtils::gen_rand_variables(size_t n)
 {
 	HandleSeq variables;
@@ -611,12 +1245,22 @@ void MinerUtils::remove_useless_clauses(const Handle& vardecl, HandleSeq& clause
 	remove_abstract_clauses(clauses);
 }
 
+void MinerUtils::remove_useless_clauses(const HandleSet& vars, HandleSeq& clauses)
+{
+	remove_constant_clauses(vars, clauses);
+	remove_redundant_subclauses(clauses);
+	remove_abstract_clauses(clauses);
+}
+
 void MinerUtils::remove_constant_clauses(const Handle& vardecl, HandleSeq& clauses)
 {
 	// Get Variables
 	VariableSetPtr vl = createVariableSet(vardecl);
-	const HandleSet& vars = vl->get_variables().varset;
+	remove_constant_clauses(vl->get_variables().varset, clauses);
+}
 
+void MinerUtils::remove_constant_clauses(const HandleSet& vars, HandleSeq& clauses)
+{
 	// Remove constant clauses
 	auto is_constant = [&](const Handle& clause) {
 		return not any_unquoted_unscoped_in_tree(clause, vars); };
@@ -773,14 +1417,17 @@ Handle MinerUtils::alpha_convert(const Handle& pattern,
 {
 	const Variables& pattern_vars = get_variables(pattern);
 
-	// Detect collision between pattern_vars and other_vars
+	// Detect collision between pattern_vars and other_vars, and
+	// replace colliding variables by the first free variables of the
+	// pool.
 	HandleMap aconv;
-	for (const Handle& var : pattern_vars.varset) {
+	size_t vi = 0;
+	for (const Handle& var : pattern_vars.varseq) {
 		if (other_vars.is_in_varset(var)) {
 			Handle nvar;
 			bool used;
 			do {
-				nvar = createNode(VARIABLE_NODE, randstr(var->get_name() + "-"));
+				nvar = gen_variable(vi++);
 				// Make sure it is not in other_vars or pattern_vars
 				used = other_vars.is_in_varset(nvar) or pattern_vars.is_in_varset(nvar);
 			} while (used);
@@ -895,6 +1542,86 @@ HandleSeqSeqSeq MinerUtils::partitions_without_pattern(const Handle& pattern)
 	return prtns;
 }
 
+HandleSeqSeqSeq MinerUtils::sample_partitions_without_pattern(const Handle& pattern,
+                                                              unsigned max_prtns,
+                                                              RandGen& rng)
+{
+	HandleSeq clauses = get_clauses(pattern);
+	unsigned n = clauses.size();
+	if (max_prtns == 0 or bell_number(n) - 1 <= max_prtns)
+		return partitions_without_pattern(pattern);
+
+	// Turn a restricted growth string into a partition
+	auto to_partition = [&](const std::vector<unsigned>& rgs) {
+		unsigned n_blocks = *std::max_element(rgs.begin(), rgs.end()) + 1;
+		HandleSeqSeq partition(n_blocks);
+		for (unsigned i = 0; i < n; i++)
+			partition[rgs[i]].push_back(clauses[i]);
+		return partition;
+	};
+
+	// Partition into singletons
+	std::vector<unsigned> singletons(n);
+	std::iota(singletons.begin(), singletons.end(), 0);
+	HandleSeqSeqSeq prtns{to_partition(singletons)};
+
+	// Partitions into 2 blocks, the first clause being always in the
+	// first block. All of them if they fit in the budget, otherwise a
+	// random sample of distinct ones.
+	double n_two_blocks = std::pow(2.0, n - 1) - 1;
+	if (n_two_blocks <= max_prtns - prtns.size()) {
+		for (unsigned long mask = 1; mask < (1UL << (n - 1)); mask++) {
+			std::vector<unsigned> rgs(n, 0);
+			for (unsigned i = 1; i < n; i++)
+				rgs[i] = (mask >> (i - 1)) & 1;
+			prtns.push_back(to_partition(rgs));
+		}
+	} else {
+		std::set<std::vector<unsigned>> sampled;
+		for (unsigned attempt = 0;
+		     prtns.size() < max_prtns and attempt < 10 * max_prtns; attempt++) {
+			std::vector<unsigned> rgs(n, 0);
+			for (unsigned i = 1; i < n; i++)
+				rgs[i] = rng.randint(2);
+			if (*std::max_element(rgs.begin(), rgs.end()) == 0
+			    or not sampled.insert(rgs).second)
+				continue;
+			prtns.push_back(to_partition(rgs));
+		}
+	}
+
+	// Fill the remaining budget with random partitions of 3 to n-1
+	// blocks. Since generated strings may repeat, the number of
+	// attempts is bounded.
+	std::set<std::vector<unsigned>> sampled;
+	for (unsigned attempt = 0;
+	     prtns.size() < max_prtns and attempt < 10 * max_prtns; attempt++) {
+		std::vector<unsigned> rgs(n, 0);
+		unsigned top = 0;
+		for (unsigned i = 1; i < n; i++) {
+			rgs[i] = rng.randint(top + 2);
+			top = std::max(top, rgs[i]);
+		}
+		if (top < 2 or top == n - 1 or not sampled.insert(rgs).second)
+			continue;
+		prtns.push_back(to_partition(rgs));
+	}
+	return prtns;
+}
+
+double MinerUtils::bell_number(unsigned n)
+{
+	// Bell triangle
+	std::vector<double> row{1.0};
+	for (unsigned i = 0; i < n; i++) {
+		std::vector<double> next{row.back()};
+		for (double b : row)
+			next.push_back(next.back() + b);
+		row = next;
+	}
+	return row.front();
+}
+
 Handle MinerUtils::expand_conjunction_disconnect(const Handle& cnjtion,
                                                  const Handle& pattern)
 {
@@ -963,7 +1690,7 @@ Handle MinerUtils::expand_conjunction_connect(const Handle& cnjtion,
 	// Recreate expanded conjunction
 	Handle npattern = mk_pattern(nvardecl, nclauses);
 
-	return npattern;
+	return npattern ? canonical_rename(npattern) : npattern;
 }
 
 HandleSet MinerUtils::expand_conjunction_rec(const Handle& cnjtion,
@@ -974,38 +1701,73 @@ HandleSet MinerUtils::expand_conjunction_rec(const Handle& cnjtion,
                                              const HandleMap& pv2cv,
                                              unsigned pvi)
 {
-	HandleSet patterns;
+	return expand_conjunction_rec(cnjtion, pattern, db, ms, mv,
+	                              variable_symmetry_classes(pattern),
+	                              variable_symmetry_classes(cnjtion),
+	                              nullptr, pv2cv, pvi);
+}
+
+HandleSet MinerUtils::expand_conjunction_rec(const Handle& cnjtion,
+                                             const Handle& pattern,
+                                             const HandleSeq& db,
+                                             unsigned ms,
+                                             unsigned mv,
+                                             const std::vector<unsigned>& pcls,
+                                             const std::vector<unsigned>& ccls,
+                                             InfrequentCache* ic,
+                                             const HandleMap& pv2cv,
+                                             unsigned pvi)
+{
 	const Variables& cvars = get_variables(cnjtion);
 	const Variables& pvars = get_variables(pattern);
+
+	// Build all direct extensions of pv2cv, alongside their
+	// corresponding patterns, if they are to be considered.
+	std::vector<std::pair<HandleMap, unsigned>> exts;
+	HandleSeq npats;
 	for (; pvi < pvars.size(); pvi++) {
-		for (const Handle& cv : cvars.varseq) {
+		for (unsigned cvi = 0; cvi < cvars.size(); cvi++) {
+			// Skip mappings that are symmetric to already enumerated
+			// ones, as well as all their extensions.
+			if (not is_lex_leader(pvars, cvars, pcls, ccls, pv2cv, pvi, cvi))
+				continue;
+
 			HandleMap pv2cv_ext(pv2cv);
-			pv2cv_ext[pvars.varseq[pvi]] = cv;
+			pv2cv_ext[pvars.varseq[pvi]] = cvars.varseq[cvi];
 			Handle npat = expand_conjunction_connect(cnjtion, pattern, pv2cv_ext);
 
 			// If the number of variables is too high or the number of
 			// conjuncts has dropped then it shouldn't be considered.
-			if (get_variables(npat).size() <= mv and
-			    n_conjuncts(cnjtion) < n_conjuncts(npat)) {
-
-				// Insert npat in the atomspace where cnjtion and pattern
-				// are, before memoizing its support.
-				if (cnjtion->getAtomSpace())
-					npat = cnjtion->getAtomSpace()->add_atom(npat);
+			if (mv < get_variables(npat).size() or
+			    n_conjuncts(npat) <= n_conjuncts(cnjtion))
+				npat = Handle::UNDEFINED;
 
-				// If npat does not have enough support, any recursive
-				// call will produce specializations that do not have
-				// enough support, thus can be ignored.
-				if (not enough_support(npat, db, ms))
-					continue;
+			exts.emplace_back(pv2cv_ext, pvi + 1);
+			npats.push_back(npat);
+		}
+	}
 
-				patterns.insert(npat);
-			}
+	// Insert patterns with enough support in the atomspace where
+	// cnjtion and pattern are, with their memoized supports, all at
+	// once.
+	HandleSeq fpats = add_if_enough_support(npats, cnjtion->getAtomSpace(),
+	                                        db, ms, ic);
 
-			HandleSet rrs = expand_conjunction_rec(cnjtion, pattern, db, ms, mv,
-			                                       pv2cv_ext, pvi + 1);
-			patterns.insert(rrs.begin(), rrs.end());
+	HandleSet patterns;
+	for (size_t i = 0; i < exts.size(); i++) {
+		if (npats[i]) {
+			// If npat does not have enough support, any recursive
+			// call will produce specializations that do not have
+			// enough support, thus can be ignored.
+			if (not fpats[i])
+				continue;
+			patterns.insert(fpats[i]);
 		}
+
+		HandleSet rrs = expand_conjunction_rec(cnjtion, pattern, db, ms, mv,
+		                                       pcls, ccls, ic,
+		                                       exts[i].first, exts[i].second);
+		patterns.insert(rrs.begin(), rrs.end());
 	}
 	return patterns;
 }
@@ -1017,6 +1779,45 @@ HandleSet MinerUtils::expand_conjunction_es_rec(const Handle& cnjtion,
                                                 unsigned mv,
                                                 const HandleMap& pv2cv,
                                                 unsigned pvi)
+{
+	return expand_conjunction_es_rec(cnjtion, pattern, db, ms, mv,
+	                                 variable_symmetry_classes(pattern),
+	                                 variable_symmetry_classes(cnjtion),
+	                                 nullptr, pv2cv, pvi);
+}
+
+HandleSet MinerUtils::expand_conjunction_es_rec(const Handle& cnjtion,
+                                                const Handle& pattern,
+                                                const HandleSeq& db,
+                                                unsigned ms,
+                                                unsigned mv,
+                                                const std::vector<unsigned>& pcls,
+                                                const std::vector<unsigned>& ccls,
+                                                InfrequentCache* ic,
+                                                const HandleMap& pv2cv,
+                                                unsigned pvi)
+{
+	// Generate all candidates, then insert the ones with enough
+	// support in the atomspace where cnjtion and pattern are, with
+	// their memoized supports, all at once.
+	HandleSet cands = expand_conjunction_es_candidates(cnjtion, pattern, mv,
+	                                                   pcls, ccls, pv2cv, pvi);
+	HandleSeq fpats = add_if_enough_support(HandleSeq(cands.begin(), cands.end()),
+	                                        cnjtion->getAtomSpace(), db, ms, ic);
+	HandleSet patterns;
+	for (const Handle& fpat : fpats)
+		if (fpat)
+			patterns.insert(fpat);
+	return patterns;
+}
+
+HandleSet MinerUtils::expand_conjunction_es_candidates(const Handle& cnjtion,
+                                                       const Handle& pattern,
+                                                       unsigned mv,
+                                                       const std::vector<unsigned>& pcls,
+                                                       const std::vector<unsigned>& ccls,
+                                                       const HandleMap& pv2cv,
+                                                       unsigned pvi)
 {
 	const Variables& pvars = get_variables(pattern);
 
@@ -1035,16 +1836,6 @@ HandleSet MinerUtils::expand_conjunction_es_rec(const Handle& cnjtion,
 		    n_conjuncts(npat) <= n_conjuncts(cnjtion))
 			return {};
 
-		// Insert npat in the atomspace where cnjtion and pattern
-		// are, before memoizing its support.
-		if (cnjtion->getAtomSpace())
-			npat = cnjtion->getAtomSpace()->add_atom(npat);
-
-		// If npat does not have enough support, it shouldn't be
-		// considered.
-		if (not enough_support(npat, db, ms))
-			return {};
-
 		return {npat};
 	}
 
@@ -1052,16 +1843,90 @@ HandleSet MinerUtils::expand_conjunction_es_rec(const Handle& cnjtion,
 	// Recursive case   //
 	//////////////////////
 
-	HandleSet patterns;
+	HandleSet cands;
 	const Variables& cvars = get_variables(cnjtion);
-	for (const Handle& cv : cvars.varseq) {
+	for (unsigned cvi = 0; cvi < cvars.size(); cvi++) {
+		// Skip mappings that are symmetric to already enumerated ones
+		if (not is_lex_leader(pvars, cvars, pcls, ccls, pv2cv, pvi, cvi))
+			continue;
+
 		HandleMap pv2cv_ext(pv2cv);
-		pv2cv_ext[pvars.varseq[pvi]] = cv;
-		HandleSet rrs = expand_conjunction_es_rec(cnjtion, pattern, db, ms,
-		                                          mv, pv2cv_ext, pvi + 1);
-		patterns.insert(rrs.begin(), rrs.end());
+		pv2cv_ext[pvars.varseq[pvi]] = cvars.varseq[cvi];
+		HandleSet rcs = expand_conjunction_es_candidates(cnjtion, pattern, mv,
+		                                                 pcls, ccls,
+		                                                 pv2cv_ext, pvi + 1);
+		cands.insert(rcs.begin(), rcs.end());
 	}
-	return patterns;
+	return cands;
+}
+
+std::vector<unsigned> MinerUtils::variable_symmetry_classes(const Handle& pattern)
+{
+	const Variables& vars = get_variables(pattern);
+	const Handle& body = get_body(pattern);
+	size_t n = vars.size();
+
+	// Union-find over variable indices, where the representative of a
+	// class is always its smallest index.
+	std::vector<unsigned> cls(n);
+	std::iota(cls.begin(), cls.end(), 0);
+	std::function<unsigned(unsigned)> root = [&](unsigned i) -> unsigned {
+		return cls[i] == i ? i : cls[i] = root(cls[i]);
+	};
+
+	// Typed variables are not interchangeable in general, don't
+	// bother.
+	if (not vars._typemap.empty())
+		return cls;
+
+	for (unsigned i = 0; i < n; i++) {
+		for (unsigned j = i + 1; j < n; j++) {
+			if (root(i) == root(j))
+				continue;
+			const Handle& vi = vars.varseq[i];
+			const Handle& vj = vars.varseq[j];
+			Handle sbody = vars.substitute_nocheck(body, {{vi, vj}, {vj, vi}});
+			if (content_eq(sbody, body)) {
+				unsigned ri = root(i), rj = root(j);
+				cls[std::max(ri, rj)] = std::min(ri, rj);
+			}
+		}
+	}
+	for (unsigned i = 0; i < n; i++)
+		cls[i] = root(i);
+	return cls;
+}
+
+bool MinerUtils::is_lex_leader(const Variables& pvars,
+                               const Variables& cvars,
+                               const std::vector<unsigned>& pcls,
+                               const std::vector<unsigned>& ccls,
+                               const HandleMap& pv2cv,
+                               unsigned pvi,
+                               unsigned cvi)
+{
+	// Pattern variables of the same class must be mapped to
+	// nondecreasing cnjtion variable indices, an unmapped variable
+	// being considered as mapped to infinity.
+	for (unsigned i = 0; i < pvi; i++) {
+		if (pcls[i] != pcls[pvi])
+			continue;
+		auto it = pv2cv.find(pvars.varseq[i]);
+		if (it == pv2cv.end() or cvi < cvars.index.at(it->second))
+			return false;
+	}
+
+	// A cnjtion variable can only be used for the first time if all
+	// smaller variables of its class have been used before.
+	std::set<unsigned> used;
+	for (const auto& pc : pv2cv)
+		used.insert(cvars.index.at(pc.second));
+	if (used.find(cvi) != used.end())
+		return true;
+	for (unsigned c = ccls[cvi]; c < cvi; c++)
+		if (ccls[c] == ccls[cvi] and used.find(c) == used.end())
+			return false;
+	return true;
 }
 
 HandleSet MinerUtils::expand_conjunction(const Handle& cnjtion,
@@ -1069,16 +1934,38 @@ HandleSet MinerUtils::expand_conjunction(const Handle& cnjtion,
                                          const HandleSeq& db,
                                          unsigned ms,
                                          unsigned mv,
-                                         bool es)
+                                         bool es,
+                                         InfrequentCache* ic)
 {
 	// Alpha convert pattern, if necessary, to avoid collisions between
 	// cnjtion variables and pattern variables
 	Handle apat = alpha_convert(pattern, get_variables(cnjtion));
 
-	// Consider all variable mappings from apat to cnjtion
+	// Consider all variable mappings from apat to cnjtion, modulo
+	// their symmetries
+	std::vector<unsigned> pcls = variable_symmetry_classes(apat),
+		ccls = variable_symmetry_classes(cnjtion);
 	return es ?
-		expand_conjunction_es_rec(cnjtion, apat, db, ms, mv)
-		: expand_conjunction_rec(cnjtion, apat, db, ms, mv);
+		expand_conjunction_es_rec(cnjtion, apat, db, ms, mv, pcls, ccls, ic)
+		: expand_conjunction_rec(cnjtion, apat, db, ms, mv, pcls, ccls, ic);
+}
+
+HandleSetSeq MinerUtils::expand_conjunction_batch(const std::vector<std::pair<Handle, Handle>>& pairs,
+                                                  const HandleSeq& db,
+                                                  unsigned ms,
+                                                  unsigned mv,
+                                                  bool es,
+                                                  InfrequentCache* ic)
+{
+	InfrequentCache local_ic;
+	if (not ic)
+		ic = &local_ic;
+
+	HandleSetSeq results;
+	for (const auto& pair : pairs)
+		results.push_back(expand_conjunction(pair.first, pair.second,
+		                                     db, ms, mv, es, ic));
+	return results;
 }
 
 const Handle& MinerUtils::support_key()
@@ -1113,6 +2000,76 @@ double MinerUtils::support_mem(const Handle& pattern,
 	return sup;
 }
 
+Handle MinerUtils::add_if_enough_support(const Handle& pattern,
+                                         AtomSpace* as,
+                                         const HandleSeq& db,
+                                         unsigned ms)
+{
+	// Reuse the memoized support of pattern if it is already in as
+	Handle apat = as ? as->get_atom(pattern) : Handle::UNDEFINED;
+	if (apat)
+		return enough_support(apat, db, ms) ? apat : Handle::UNDEFINED;
+
+	// Otherwise calculate its support before adding anything to as,
+	// so that infrequent candidates never make it to the atomspace.
+	double sup = support_mem(pattern, db, ms);
+	if (sup < ms)
+		return Handle::UNDEFINED;
+	if (not as)
+		return pattern;
+	apat = as->add_atom(pattern);
+	set_support(apat, sup);
+	return apat;
+}
+
+HandleSeq MinerUtils::add_if_enough_support(const HandleSeq& patterns,
+                                           AtomSpace* as,
+                                           const HandleSeq& db,
+                                           unsigned ms,
+                                           InfrequentCache* ic)
+{
+	HandleSeq results(patterns.size());
+
+	// Reuse memoized supports when possible, and collect the other
+	// patterns to calculate their supports all at once.
+	HandleSeq batch;
+	std::vector<size_t> batch_idx;
+	for (size_t i = 0; i < patterns.size(); i++) {
+		if (not patterns[i])
+			continue;
+		// Reject patterns known to be infrequent before any matching
+		if (ic and ic->is_known_infrequent(patterns[i]))
+			continue;
+		Handle apat = as ? as->get_atom(patterns[i]) : Handle::UNDEFINED;
+		if (not apat)
+			apat = patterns[i];
+		double sup = get_support(apat);
+		if (sup < 0) {
+			batch.push_back(apat);
+			batch_idx.push_back(i);
+		} else if (ms <= sup) {
+			results[i] = as ? as->add_atom(apat) : apat;
+			set_support(results[i], sup);
+		} else if (ic) {
+			ic->insert(apat);
+		}
+	}
+
+	std::vector<unsigned> sups = batch_support(batch, db, ms);
+	for (size_t k = 0; k < batch.size(); k++) {
+		set_support(batch[k], sups[k]);
+		if (sups[k] < ms) {
+			if (ic)
+				ic->insert(batch[k]);
+			continue;
+		}
+		Handle& result = results[batch_idx[k]];
+		result = as ? as->add_atom(batch[k]) : batch[k];
+		set_support(result, sups[k]);
+	}
+	return results;
+}
+
 void MinerUtils::remove_if(HandleSeq& clauses,
                            std::function<bool(const Handle&, const HandleSeq&)> fun)
 {
@@ -1129,6 +2086,61 @@ void MinerUtils::remove_if(HandleSeq& clauses,
 	}
 }
 
+// Set within the worker threads of parallel_for so that nested calls
+// run serially
+static thread_local bool in_worker = false;
+
+unsigned MinerUtils::effective_jobs(unsigned jobs)
+{
+	return in_worker ? 1 : std::max(1U, jobs);
+}
+
+void MinerUtils::parallel_for(size_t n, unsigned jobs,
+                              const std::function<void(size_t)>& fun)
+{
+	size_t n_threads = std::min((size_t)effective_jobs(jobs), n);
+	if (n_threads <= 1) {
+		for (size_t i = 0; i < n; i++)
+			fun(i);
+		return;
+	}
+
+	std::atomic<size_t> next(0);
+	std::exception_ptr eptr;
+	std::mutex eptr_mtx;
+	auto worker = [&]() {
+		in_worker = true;
+		for (size_t i = next++; i < n; i = next++) {
+			try {
+				fun(i);
+			} catch (...) {
+				std::lock_guard<std::mutex> lock(eptr_mtx);
+				if (not eptr)
+					eptr = std::current_exception();
+			}
+		}
+	};
+	std::vector<std::thread> threads;
+	for (size_t t = 0; t < n_threads; t++)
+		threads.emplace_back(worker);
+	for (std::thread& thread : threads)
+		thread.join();
+
+	if (eptr)
+		std::rethrow_exception(eptr);
+}
+
+size_t MinerUtils::resident_memory()
+{
+	// The second field of statm is the number of resident pages
+	std::ifstream statm("/proc/self/statm");
+	size_t size, resident;
+	if (not (statm >> size >> resident))
+		return 0;
+	long page_size = sysconf(_SC_PAGESIZE);
+	return page_size < 0 ? 0 : resident * (size_t)page_size;
+}
+
 std::string oc_to_string(const HandleSeqSeqSeq& hsss,
                          const std::string& indent)
 {
@@ -24,6 +24,7 @@
 #define OPENCOG_MINER_UTILS_H_
 
 #include <opencog/util/empty_string.h>
+#include <opencog/util/RandGen.h>
 #include <opencog/atoms/base/Handle.h>
 #include <opencog/unify/Unify.h>
 
@@ -32,6 +33,9 @@
 namespace opencog
 {
 
+class AtomSpace;
+class InfrequentCache;
+
 typedef std::vector<HandleSeqSeq> HandleSeqSeqSeq;
 
 /**
@@ -170,9 +174,23 @@ public:
 	 * sub-patterns. That is replace variables in the pattern by their
 	 * associated sub-patterns, properly updating the variable
 	 * declaration.
+	 *
+	 * Sub-patterns are alpha-converted to avoid collisions, and the
+	 * result is canonically renamed (see canonical_rename).
 	 */
 	static Handle compose(const Handle& pattern, const HandleMap& var2pat);
 
+	/**
+	 * Like compose but directly builds the composed pattern from the
+	 * substituted clauses and variables, without going through
+	 * RewriteLink::beta_reduce, thus avoiding the creation of
+	 * intermediary scope links. Only handles the common cases of
+	 * untyped patterns composed with constants, variables or shallow
+	 * abstractions. Return Handle::UNDEFINED in all other cases, in
+	 * which case compose falls back on beta-reduction.
+	 */
+	static Handle fast_compose(const Handle& pattern, const HandleMap& var2pat);
+
 	/**
 	 * Given a db concept node, retrieve all its members
 	 */
@@ -196,6 +214,17 @@ public:
 	                        const HandleSeq& db,
 	                        unsigned ms);
 
+	/**
+	 * Like above but only over the data trees of db at the given
+	 * indices, such as obtained by subsampling. The selected data
+	 * trees are loaded once for all components of pattern, without
+	 * copying db.
+	 */
+	static unsigned support(const Handle& pattern,
+	                        const HandleSeq& db,
+	                        const std::vector<unsigned>& indices,
+	                        unsigned ms);
+
 	/**
 	 * Like support but assumes that pattern is strongly connected (all
 	 * its variables depends on other clauses).
@@ -204,6 +233,32 @@ public:
 	                                  const HandleSeq& db,
 	                                  unsigned ms);
 
+	/**
+	 * Like support but calculate the supports of multiple patterns
+	 * at once, calculating the support of components shared by
+	 * several patterns only once. The db is loaded in an atomspace
+	 * once for all patterns, or not at all if it is shared (see
+	 * share_db_copy).
+	 *
+	 * Return the supports (up to ms) in the same order as patterns.
+	 */
+	static std::vector<unsigned> batch_support(const HandleSeq& patterns,
+	                                           const HandleSeq& db,
+	                                           unsigned ms);
+
+	/**
+	 * Copy db in its own atomspace, shared read-only by all threads
+	 * calculating supports over db (see restricted_satisfying_set and
+	 * batch_support), till the matching call of release_db_copy.
+	 * Calls are counted so that they can be nested.
+	 *
+	 * The copy is identified by the address and size of db, which
+	 * must thus be left untouched in the meantime. Outside of these
+	 * calls the db is copied anew by each support calculation.
+	 */
+	static void share_db_copy(const HandleSeq& db);
+	static void release_db_copy(const HandleSeq& db);
+
 	/**
 	 * Calculate if the pattern has enough support w.r.t. to the given
 	 * db, that is whether its frequency is greater than or equal
@@ -237,6 +292,39 @@ public:
 	                                    unsigned ms,
 	                                    unsigned mv=UINT_MAX);
 
+	/**
+	 * Return generalizations of pattern undoing one shallow
+	 * specialization, that is obtained by
+	 *
+	 * 1. replacing all occurrences of a constant node by a new
+	 *    variable,
+	 * 2. replacing a link whose outgoings are distinct variables
+	 *    occurring nowhere else by a new variable,
+	 * 3. replacing one occurrence of a variable occurring multiple
+	 *    times by a new variable.
+	 *
+	 * Since support is anti-monotonic, if any of them is infrequent
+	 * so is pattern. Patterns with typed variables or quotations have
+	 * no generalizations.
+	 */
+	static HandleSeq shallow_generalizations(const Handle& pattern);
+
+	/**
+	 * Like shallow_specialize but over several patterns, returning
+	 * the union of their shallow specializations, added to as.
+	 *
+	 * as serves as a support cache shared across the batch: a
+	 * specialization reached from several patterns, up to
+	 * alpha-equivalence, is returned once with the support
+	 * calculated the first time, and a pattern alpha-equivalent to a
+	 * previous one is not specialized again.
+	 */
+	static HandleSet shallow_specialize_batch(const HandleSeq& patterns,
+	                                          const HandleSeq& db,
+	                                          unsigned ms,
+	                                          unsigned mv,
+	                                          AtomSpace& as);
+
 	/**
 	 * Create a pattern body from clauses, introducing an AndLink if
 	 * necessary.
@@ -314,6 +402,25 @@ public:
 	                                        const HandleSeq& db,
 	                                        unsigned ms=UINT_MAX);
 
+	/**
+	 * Like above but db_as is assumed to already contain db (and only
+	 * db), so that the db does not need to be reloaded across calls.
+	 */
+	static Handle restricted_satisfying_set(const Handle& pattern,
+	                                        AtomSpace& db_as,
+	                                        const HandleSeq& db,
+	                                        unsigned ms=UINT_MAX);
+
+	/**
+	 * Like restricted_satisfying_set but pass each grounding to
+	 * on_grounding as it is found, rather than collecting them. A
+	 * grounding is the sequence of values of the variables of
+	 * pattern, in the order of its variable declaration.
+	 */
+	static void for_each_grounding(const Handle& pattern,
+	                               const HandleSeq& db,
+	                               const std::function<void(const HandleSeq&)>& on_grounding);
+
 	/**
 	 * Return true iff the pattern is totally abstract like
 	 *
@@ -341,6 +448,57 @@ public:
 	static HandleSeq gen_rand_variables(size_t n);
 	static Handle gen_rand_variable();
 
+	/**
+	 * Return the first n variables of the variable pool, that is
+	 *
+	 * $PM-0, ..., $PM-<n-1>
+	 *
+	 * Using a deterministic pool, rather than random variables, allows
+	 * identical patterns to be made of the same atoms, thus share
+	 * memoized values, and makes mining reproducible.
+	 */
+	static HandleSeq gen_variables(size_t n);
+
+	/**
+	 * Return the i-th variable of the pool, $PM-<i>. The same atom is
+	 * returned across calls and threads. Only growing the pool takes
+	 * a lock.
+	 */
+	static Handle gen_variable(size_t i);
+
+	/**
+	 * Rename the variables of pattern with the variables of the pool,
+	 * $PM-0, $PM-1, etc, so that alpha-equivalent patterns are renamed
+	 * into the same pattern.
+	 *
+	 * Variables are coloured by the clauses they occur in, and their
+	 * positions in them, refining till stable. Variables left sharing
+	 * a colour are individualized in turn, keeping the renaming
+	 * yielding the smallest body. Within a renaming variables are
+	 * named by order of first occurrence, clauses being ordered by
+	 * colour. For instance
+	 *
+	 * (Lambda
+	 *   (VariableSet (Variable "$X") (Variable "$Y"))
+	 *   (Present (Inheritance (Variable "$Y") (Variable "$X"))))
+	 *
+	 * is renamed into
+	 *
+	 * (Lambda
+	 *   (VariableSet (Variable "$PM-0") (Variable "$PM-1"))
+	 *   (Present (Inheritance (Variable "$PM-0") (Variable "$PM-1"))))
+	 *
+	 * Patterns with typed variables are left unchanged. For highly
+	 * symmetric patterns only the first 1024 renamings are explored.
+	 */
+	static Handle canonical_rename(const Handle& pattern);
+
+	/**
+	 * Hash of h ignoring the names of the variables in vars, as well
+	 * as the order of the outgoings of unordered links.
+	 */
+	static size_t shape_hash(const Handle& h, const HandleSet& vars);
+
 	/**
 	 * Given a pattern return its variables. If the pattern is not a
 	 * scope link (i.e. a data tree), then return the empty Variables.
@@ -384,6 +542,8 @@ public:
 	                                     const Handle& body);
 	static void remove_useless_clauses(const Handle& vardecl,
 	                                   HandleSeq& clauses);
+	static void remove_useless_clauses(const HandleSet& vars,
+	                                   HandleSeq& clauses);
 
 	/**
 	 * Remove any closes clause (regardless of whether they are
@@ -391,6 +551,8 @@ public:
 	 */
 	static void remove_constant_clauses(const Handle& vardecl,
 	                                    HandleSeq& clauses);
+	static void remove_constant_clauses(const HandleSet& vars,
+	                                    HandleSeq& clauses);
 
 	/**
 	 * Remove redundant subclauses, such as ones identical to clauses
@@ -537,7 +699,8 @@ public:
 
 	/**
 	 * Alpha convert pattern so that none of its variables collide with
-	 * the variables in other_vars.
+	 * the variables in other_vars. Colliding variables are replaced by
+	 * the first unused variables of the pool (see gen_variable).
 	 */
 	static Handle alpha_convert(const Handle& pattern,
 	                            const Variables& other_vars);
@@ -641,6 +804,28 @@ public:
 	 */
 	static HandleSeqSeqSeq partitions_without_pattern(const Handle& pattern);
 
+	/**
+	 * Like partitions_without_pattern but return a sample of at most
+	 * max_prtns partitions, unless max_prtns is 0 or not below the
+	 * number of partitions, in which case all of them are returned.
+	 *
+	 * The partition into singletons always comes first, as relied
+	 * upon by Surprisingness::isurp_upper_bound, followed by all
+	 * partitions into 2 blocks if they fit in the budget, or else by
+	 * a random sample of them filling it. The remaining budget, if
+	 * any, is filled with distinct partitions of more blocks. Random
+	 * partitions are generated with rng as restricted growth strings.
+	 */
+	static HandleSeqSeqSeq sample_partitions_without_pattern(const Handle& pattern,
+	                                                         unsigned max_prtns,
+	                                                         RandGen& rng);
+
+	/**
+	 * Return the Bell number of n, that is the number of partitions
+	 * of a set of size n, as a double to avoid overflow.
+	 */
+	static double bell_number(unsigned n);
+
 	/**
 	 * Construct the conjunction of 2 patterns. If cnjtion is a
 	 * conjunction, then expand it with pattern (performing
@@ -704,6 +889,101 @@ public:
 	                                           const HandleMap& pv2cv=HandleMap(),
 	                                           unsigned pvi=0);
 
+	/**
+	 * Like above but take the symmetry classes of the variables of
+	 * pattern and cnjtion (see variable_symmetry_classes) to only
+	 * enumerate one mapping amongst symmetric ones (see
+	 * is_lex_leader).
+	 *
+	 * If ic is provided, candidates known to be infrequent are
+	 * rejected without calculating their supports, and newly found
+	 * infrequent candidates are recorded into it.
+	 */
+	static HandleSet expand_conjunction_rec(const Handle& cnjtion,
+	                                        const Handle& pattern,
+	                                        const HandleSeq& db,
+	                                        unsigned ms,
+	                                        unsigned mv,
+	                                        const std::vector<unsigned>& pcls,
+	                                        const std::vector<unsigned>& ccls,
+	                                        InfrequentCache* ic=nullptr,
+	                                        const HandleMap& pv2cv=HandleMap(),
+	                                        unsigned pvi=0);
+	static HandleSet expand_conjunction_es_rec(const Handle& cnjtion,
+	                                           const Handle& pattern,
+	                                           const HandleSeq& db,
+	                                           unsigned ms,
+	                                           unsigned mv,
+	                                           const std::vector<unsigned>& pcls,
+	                                           const std::vector<unsigned>& ccls,
+	                                           InfrequentCache* ic=nullptr,
+	                                           const HandleMap& pv2cv=HandleMap(),
+	                                           unsigned pvi=0);
+
+	/**
+	 * Like expand_conjunction_es_rec but does not check the support of
+	 * the resulting patterns, so that expand_conjunction_es_rec can
+	 * check them all at once.
+	 */
+	static HandleSet expand_conjunction_es_candidates(const Handle& cnjtion,
+	                                                  const Handle& pattern,
+	                                                  unsigned mv,
+	                                                  const std::vector<unsigned>& pcls,
+	                                                  const std::vector<unsigned>& ccls,
+	                                                  const HandleMap& pv2cv=HandleMap(),
+	                                                  unsigned pvi=0);
+
+	/**
+	 * Partition the variables of pattern into symmetry classes, where
+	 * two variables are in the same class if swapping them leaves the
+	 * body of pattern unchanged (which typically happens with
+	 * variables of clauses only differing by these variables, since
+	 * the body is an unordered PresentLink). Since transpositions
+	 * generate the full permutation group of each class, any
+	 * permutation of the variables within a class leaves the pattern
+	 * unchanged.
+	 *
+	 * Return, for each variable (following the order of varseq), the
+	 * index of the smallest variable of its class.
+	 *
+	 * For instance, given
+	 *
+	 * pattern = (Lambda
+	 *             (VariableSet X Y Z)
+	 *             (Present
+	 *               (Inheritance X Z)
+	 *               (Inheritance Y Z)))
+	 *
+	 * return [0, 0, 2]
+	 */
+	static std::vector<unsigned> variable_symmetry_classes(const Handle& pattern);
+
+	/**
+	 * Return true iff extending the partial mapping pv2cv, from the
+	 * variables of pattern up to (excluded) pvi to the variables of
+	 * cnjtion, with pvars[pvi]->cvars[cvi] does not break the
+	 * lex-leader constraints of the symmetry classes pcls and ccls,
+	 * that is
+	 *
+	 * 1. variables of pattern in the same class are mapped to
+	 *    nondecreasing indices of cnjtion variables (unmapped
+	 *    variables being considered as mapped to infinity).
+	 *
+	 * 2. a variable of cnjtion can only be used for the first time if
+	 *    all smaller variables of its class have already been used.
+	 *
+	 * Any mapping breaking these constraints produces a pattern that
+	 * is alpha-equivalent to the one produced by another mapping
+	 * honoring them, and so are all its extensions.
+	 */
+	static bool is_lex_leader(const Variables& pvars,
+	                          const Variables& cvars,
+	                          const std::vector<unsigned>& pcls,
+	                          const std::vector<unsigned>& ccls,
+	                          const HandleMap& pv2cv,
+	                          unsigned pvi,
+	                          unsigned cvi);
+
 	/**
 	 * Given cnjtion and pattern, consider all possible connections
 	 * (a.k.a linkages) and expand cnjtion accordingly. For instance if
@@ -727,13 +1007,34 @@ public:
 	 *
 	 * es is a flag to enforce specialization by
 	 *    discarding new variables.
+	 *
+	 * ic is an optional cache of infrequent patterns, relative to db
+	 *    and ms, used to prune candidates and updated with the newly
+	 *    found infrequent ones.
 	 */
 	static HandleSet expand_conjunction(const Handle& cnjtion,
 	                                    const Handle& pattern,
 	                                    const HandleSeq& db,
 	                                    unsigned ms,
 	                                    unsigned mv=UINT_MAX,
-	                                    bool es=true);
+	                                    bool es=true,
+	                                    InfrequentCache* ic=nullptr);
+
+	/**
+	 * Like expand_conjunction but over several (conjunction,
+	 * pattern) pairs, returning the expansions of each pair, in the
+	 * same order.
+	 *
+	 * The infrequent patterns found while expanding a pair are used
+	 * to prune the candidates of the next ones, through ic if
+	 * provided, otherwise through a cache local to the batch.
+	 */
+	static HandleSetSeq expand_conjunction_batch(const std::vector<std::pair<Handle, Handle>>& pairs,
+	                                             const HandleSeq& db,
+	                                             unsigned ms,
+	                                             unsigned mv=UINT_MAX,
+	                                             bool es=true,
+	                                             InfrequentCache* ic=nullptr);
 
 	/**
 	 * Return an atom to serve as key to store the support value.
@@ -765,6 +1066,37 @@ public:
 	                          const HandleSeq& db,
 	                          unsigned ms);
 
+	/**
+	 * If pattern has enough support, w.r.t. db and ms, then add it to
+	 * as (if as is not null) along with its memoized support, and
+	 * return it. Otherwise return Handle::UNDEFINED.
+	 *
+	 * If pattern is already in as, its memoized support is reused,
+	 * otherwise the support is calculated before pattern is added, so
+	 * that patterns without enough support never pollute as.
+	 */
+	static Handle add_if_enough_support(const Handle& pattern,
+	                                    AtomSpace* as,
+	                                    const HandleSeq& db,
+	                                    unsigned ms);
+
+	/**
+	 * Like above but over multiple patterns, the supports of the
+	 * patterns that are not already memoized being calculated all at
+	 * once with batch_support. Undefined patterns are ignored.
+	 *
+	 * If ic is provided, patterns known to be infrequent are rejected
+	 * right away, and the ones found infrequent are recorded into it.
+	 *
+	 * Return a sequence of the same size as patterns, with
+	 * Handle::UNDEFINED in place of patterns without enough support.
+	 */
+	static HandleSeq add_if_enough_support(const HandleSeq& patterns,
+	                                       AtomSpace* as,
+	                                       const HandleSeq& db,
+	                                       unsigned ms,
+	                                       InfrequentCache* ic=nullptr);
+
 	/**
 	 * Remove every element of clauses such that
 	 *
@@ -774,6 +1106,48 @@ public:
 	 */
 	static void remove_if(HandleSeq& clauses,
 	                      std::function<bool(const Handle&, const HandleSeq&)> fun);
+
+	/**
+	 * Call fun(i) for each i in [0, n), distributing the calls over at
+	 * most jobs threads. Calls issued from a thread already running
+	 * inside parallel_for are run serially, to avoid oversubscription
+	 * when nesting. The first exception thrown by fun, if any, is
+	 * rethrown once all threads are joined.
+	 */
+	static void parallel_for(size_t n, unsigned jobs,
+	                         const std::function<void(size_t)>& fun);
+
+	/**
+	 * Return the number of threads parallel_for would use given
+	 * jobs, that is 1 if called from within a worker thread of
+	 * parallel_for, jobs otherwise.
+	 */
+	static unsigned effective_jobs(unsigned jobs);
+
+	/**
+	 * Return the resident set size of the process in bytes, or 0 if
+	 * it cannot be obtained on that system.
+	 */
+	static size_t resident_memory();
+};
+
+/**
+ * Share the copy of db during the lifetime of the scope, see
+ * MinerUtils::share_db_copy.
+ */
+class DbCopyScope
+{
+public:
+	DbCopyScope(const HandleSeq& db) : _db(db)
+	{
+		MinerUtils::share_db_copy(_db);
+	}
+	~DbCopyScope()
+	{
+		MinerUtils::release_db_copy(_db);
+	}
+private:
+	const HandleSeq& _db;
 };
 
 /**
@@ -0,0 +1,70 @@
+/*
+ * PatternQueue.cc
+ *
+ * Copyright (C) 2020 SingularityNET Foundation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License v3 as
+ * published by the Free Software Foundation and including the exceptions
+ * at http://opencog.org/wiki/Licenses
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program; if not, write to:
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "PatternQueue.h"
+
+#include <algorithm>
+
+namespace opencog
+{
+
+PatternQueue::PatternQueue(size_t capacity)
+	: _capacity(std::max((size_t)1, capacity)), _closed(false) {}
+
+bool PatternQueue::push(const Handle& pattern)
+{
+	std::unique_lock<std::mutex> lock(_mtx);
+	_not_full.wait(lock, [&]() {
+			return _closed or _patterns.size() < _capacity; });
+	if (_closed)
+		return false;
+	_patterns.push_back(pattern);
+	_not_empty.notify_one();
+	return true;
+}
+
+bool PatternQueue::pop(Handle& pattern)
+{
+	std::unique_lock<std::mutex> lock(_mtx);
+	_not_empty.wait(lock, [&]() { return _closed or not _patterns.empty(); });
+	if (_patterns.empty())
+		return false;
+	pattern = _patterns.front();
+	_patterns.pop_front();
+	_not_full.notify_one();
+	return true;
+}
+
+void PatternQueue::close()
+{
+	std::lock_guard<std::mutex> lock(_mtx);
+	_closed = true;
+	_not_full.notify_all();
+	_not_empty.notify_all();
+}
+
+bool PatternQueue::is_closed() const
+{
+	std::lock_guard<std::mutex> lock(_mtx);
+	return _closed;
+}
+
+} // ~namespace opencog
@@ -0,0 +1,83 @@
+/*
+ * PatternQueue.h
+ *
+ * Copyright (C) 2020 SingularityNET Foundation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Affero General Public License v3 as
+ * published by the Free Software Foundation and including the exceptions
+ * at http://opencog.org/wiki/Licenses
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program; if not, write to:
+ * Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef OPENCOG_MINER_PATTERNQUEUE_H_
+#define OPENCOG_MINER_PATTERNQUEUE_H_
+
+#include <opencog/atoms/base/Handle.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+namespace opencog
+{
+
+/**
+ * Bounded blocking queue of patterns, to pass patterns from a
+ * producer, such as the miner, to consumers, such as surprisingness
+ * workers, while bounding the memory held in between.
+ *
+ * Once closed, pushes are refused and pops return the remaining
+ * patterns, then fail.
+ */
+class PatternQueue
+{
+public:
+	/**
+	 * CTor, capacity is the maximum number of patterns held, at
+	 * least 1.
+	 */
+	PatternQueue(size_t capacity=1024);
+
+	/**
+	 * Push pattern, blocking while the queue is full. Return false,
+	 * without pushing, iff the queue is closed.
+	 */
+	bool push(const Handle& pattern);
+
+	/**
+	 * Pop the front pattern into pattern, blocking while the queue is
+	 * empty and open. Return false iff the queue is closed and empty.
+	 */
+	bool pop(Handle& pattern);
+
+	/**
+	 * Close the queue, waking up all blocked producers and
+	 * consumers. Typically called by the producer once done, or by
+	 * a consumer that fails, so that the producer does not block
+	 * forever.
+	 */
+	void close();
+
+	bool is_closed() const;
+
+private:
+	const size_t _capacity;
+	std::deque<Handle> _patterns;
+	bool _closed;
+	mutable std::mutex _mtx;
+	std::condition_variable _not_full;
+	std::condition_variable _not_empty;
+};
+
+} // ~namespace opencog
+
+#endif /* OPENCOG_MINER_PATTERNQUEUE_H_ */
@@ -25,11 +25,14 @@
 
 #include "MinerUtils.h"
 #include "MinerLogger.h"
+#include "HyperLogLog.h"
+#include "PatternQueue.h"
+#include "Miner.h"
 
 #include <opencog/util/Logger.h>
 #include <opencog/util/lazy_random_selector.h>
 #include <opencog/util/random.h>
-#include <opencog/util/dorepeat.h>
+#include <opencog/util/mt19937ar.h>
 #include <opencog/util/algorithm.h>
 #include <opencog/atomspace/AtomSpace.h>
 #include <opencog/atoms/base/Link.h>
@@ -45,10 +48,15 @@
 #include <boost/range/algorithm/sort.hpp>
 #include <boost/range/numeric.hpp>
 #include <boost/math/special_functions/binomial.hpp>
+#include <boost/functional/hash.hpp>
 
 #include <cmath>
 #include <functional>
 #include <limits>
+#include <map>
+#include <mutex>
+#include <numeric>
+#include <queue>
 
 namespace opencog {
 
@@ -95,6 +103,9 @@ double Surprisingness::isurp(const Handle& pattern,
                              bool normalize,
                              double db_ratio)
 {
+	// Load the db once for all support calculations
+	DbCopyScope db_scope(db);
+
 	// Calculate the probability estimate of each partition based on
 	// independent assumption of between each partition block, taking
 	// into account the linkage probability.
@@ -102,7 +113,7 @@ double Surprisingness::isurp(const Handle& pattern,
 
 	// Calculate the empirical probability of pattern, using
 	// boostrapping if necessary
-	double emp = emp_prob_pbs_mem(pattern, db, emax, db_ratio);
+	double emp = emp_prob_pbs_mem(pattern, db, emin, emax, db_ratio);
 
 	// Calculate the I-Surprisingness, normalized if requested.
 	double dst = dst_from_interval(emin, emax, emp);
@@ -110,6 +121,187 @@ double Surprisingness::isurp(const Handle& pattern,
 	return std::min(normalize ? dst / maxprb : dst, 1.0);
 }
 
+std::vector<double> Surprisingness::isurp_batch(const HandleSeq& patterns,
+                                                const HandleSeq& db,
+                                                bool normalize,
+                                                double db_ratio)
+{
+	DbCopyScope db_scope(db);
+
+	// Generate the partitions of all patterns, and flatten them so
+	// that they can be evaluated together
+	std::vector<HandleSeqSeqSeq> prtnss;
+	std::vector<std::pair<size_t, size_t>> pat_prtn_idxs;
+	for (size_t i = 0; i < patterns.size(); i++) {
+		prtnss.push_back(partitions(patterns[i]));
+		for (size_t j = 0; j < prtnss[i].size(); j++)
+			pat_prtn_idxs.emplace_back(i, j);
+	}
+
+	// Memoize the empirical probabilities of all distinct
+	// subpatterns, smallest first
+	for (const HandleSeq& level : subpattern_levels(prtnss, patterns))
+		MinerUtils::parallel_for(level.size(), get_jobs(), [&](size_t i) {
+				emp_prob_pbs_mem(level[i], db, db_ratio); });
+
+	// Calculate the probability estimates of all partitions
+	std::vector<double> estimates(pat_prtn_idxs.size());
+	MinerUtils::parallel_for(estimates.size(), get_jobs(), [&](size_t k) {
+			auto [i, j] = pat_prtn_idxs[k];
+			estimates[k] = ji_prob_est(prtnss[i][j], patterns[i], db, db_ratio); });
+
+	// Calculate the I-Surprisingness of each pattern, its estimates
+	// being contiguous in estimates
+	std::vector<size_t> offsets(patterns.size() + 1, 0);
+	for (size_t i = 0; i < patterns.size(); i++)
+		offsets[i + 1] = offsets[i] + prtnss[i].size();
+	std::vector<double> isurps(patterns.size());
+	MinerUtils::parallel_for(patterns.size(), get_jobs(), [&](size_t i) {
+			auto mmp = std::minmax_element(estimates.begin() + offsets[i],
+			                               estimates.begin() + offsets[i + 1]);
+			auto [emin, emax] = widen_interval(patterns[i], prtnss[i].size(),
+			                                   *mmp.first, *mmp.second);
+			double emp = emp_prob_pbs_mem(patterns[i], db, emin, emax, db_ratio);
+			double dst = dst_from_interval(emin, emax, emp);
+			double maxprb = std::max(emp, emax);
+			isurps[i] = std::min(normalize ? dst / maxprb : dst, 1.0); });
+	return isurps;
+}
+
+double Surprisingness::isurp_upper_bound(const Handle& pattern,
+                                         const HandleSeq& db,
+                                         bool normalize,
+                                         double db_ratio)
+{
+	// Probability estimate of the partition into singletons
+	HandleSeqSeq singletons;
+	for (const Handle& clause : MinerUtils::get_clauses(pattern))
+		singletons.push_back({clause});
+	double est = ji_prob_est(singletons, pattern, db, db_ratio);
+
+	// The interval of estimates contains est, thus the distance to it
+	// is at most the distance to est, and its upper bound is at least
+	// est.
+	double emp = emp_prob_pbs_mem(pattern, db, est, db_ratio);
+	double dst = std::abs(emp - est);
+	double maxprb = std::max(emp, est);
+	return std::min(normalize and 0 < maxprb ? dst / maxprb : dst, 1.0);
+}
+
+std::vector<std::pair<Handle, double>>
+Surprisingness::isurp_top_k(const HandleSeq& patterns,
+                            const HandleSeq& db,
+                            unsigned k,
+                            bool normalize,
+                            double db_ratio)
+{
+	if (k == 0)
+		return {};
+
+	DbCopyScope db_scope(db);
+
+	// Calculate the upper bounds of all patterns and sort them by
+	// decreasing upper bound
+	std::vector<double> ubs(patterns.size());
+	MinerUtils::parallel_for(patterns.size(), get_jobs(), [&](size_t i) {
+			ubs[i] = isurp_upper_bound(patterns[i], db, normalize, db_ratio); });
+	std::vector<size_t> order(patterns.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&](size_t l, size_t r) {
+			return ubs[l] > ubs[r]; });
+
+	// Min-heap of the k best scores so far
+	typedef std::pair<double, Handle> ScoredPattern;
+	std::priority_queue<ScoredPattern, std::vector<ScoredPattern>,
+	                    std::greater<ScoredPattern>> heap;
+	auto can_enter = [&](size_t i) {
+		return heap.size() < k or heap.top().first < ubs[i];
+	};
+
+	// Score the patterns that may enter the heap, as many at once as
+	// there are threads
+	size_t batch_size = MinerUtils::effective_jobs(get_jobs()), next = 0;
+	while (next < order.size() and can_enter(order[next])) {
+		HandleSeq batch;
+		for (; next < order.size() and batch.size() < batch_size
+			     and can_enter(order[next]); next++)
+			batch.push_back(patterns[order[next]]);
+		std::vector<double> isurps = isurp_batch(batch, db, normalize, db_ratio);
+		for (size_t i = 0; i < batch.size(); i++) {
+			heap.emplace(isurps[i], batch[i]);
+			if (k < heap.size())
+				heap.pop();
+		}
+	}
+	LAZY_MINER_LOG_DEBUG << "Top " << k << " I-Surprisingness: scored "
+	                     << next << " patterns out of " << patterns.size();
+
+	// Return the heap content in decreasing order
+	std::vector<std::pair<Handle, double>> top(heap.size());
+	for (auto it = top.rbegin(); it != top.rend(); ++it) {
+		*it = {heap.top().second, heap.top().first};
+		heap.pop();
+	}
+	return top;
+}
+
+std::vector<std::pair<Handle, double>>
+Surprisingness::pipelined_isurp(Miner& miner,
+                                const HandleSeq& db,
+                                AtomSpace& as,
+                                bool normalize,
+                                double db_ratio,
+                                size_t queue_size)
+{
+	DbCopyScope db_scope(db);
+
+	std::vector<std::pair<Handle, double>> scored;
+	auto keep = [&](const Handle& pattern) {
+		return 1 < MinerUtils::n_conjuncts(pattern);
+	};
+
+	// Mine then score if no thread can be spared for scoring
+	unsigned jobs = MinerUtils::effective_jobs(get_jobs());
+	if (jobs <= 1) {
+		for (const Handle& pattern : miner.native_mine(db))
+			if (keep(pattern)) {
+				Handle cp = as.add_atom(pattern);
+				scored.emplace_back(cp, isurp(cp, db, normalize, db_ratio));
+			}
+		return scored;
+	}
+
+	// Task 0 mines and fills the queue, the jobs other tasks empty it
+	// and score the patterns. Whoever fails closes the queue so that
+	// no one is left waiting.
+	PatternQueue queue(queue_size);
+	std::mutex scored_mtx;
+	auto on_pattern = [&](const Handle& pattern, unsigned) {
+		return not keep(pattern) or queue.push(as.add_atom(pattern));
+	};
+	MinerUtils::parallel_for(jobs + 1, jobs + 1, [&](size_t i) {
+			try {
+				if (i == 0) {
+					miner.native_mine(db, on_pattern);
+					queue.close();
+					return;
+				}
+				Handle pattern;
+				while (queue.pop(pattern)) {
+					double sc = isurp(pattern, db, normalize, db_ratio);
+					std::lock_guard<std::mutex> lock(scored_mtx);
+					scored.emplace_back(pattern, sc);
+				}
+			} catch (...) {
+				queue.close();
+				throw;
+			}
+		});
+	LAZY_MINER_LOG_DEBUG << "Pipelined I-Surprisingness: scored "
+	                     << scored.size() << " patterns";
+	return scored;
+}
+
 double Surprisingness::dst_from_interval(double l, double u, double v)
 {
 	return (u < v ? v - u : (v < l ? l - v : 0.0));
@@ -152,11 +344,55 @@ unsigned Surprisingness::value_count(const HandleSeq& block,
                                      const Handle& var,
                                      const HandleSeq& db)
 {
+	if (0 < get_value_count_error())
+		return approx_value_count(block, var, db);
+
 	Valuations vs(MinerUtils::mk_pattern_no_vardecl(block), db);
 	HandleUCounter values = vs.values(var);
 	return values.keys().size();
 }
 
+unsigned Surprisingness::approx_value_count(const HandleSeq& block,
+                                            const Handle& var,
+                                            const HandleSeq& db)
+{
+	// Only the strongly connected component containing var matters,
+	// the others merely multiply the count of each value, unless
+	// they have no grounding at all, in which case var has no value.
+	Handle pattern = MinerUtils::remove_useless_clauses(
+		MinerUtils::mk_pattern_no_vardecl(block));
+	HandleSeq cps = MinerUtils::get_component_patterns(pattern);
+	Handle var_cp;
+	for (const Handle& cp : cps) {
+		if (MinerUtils::get_variables(cp).is_in_varset(var))
+			var_cp = cp;
+		else if (MinerUtils::component_support(cp, db, 1) == 0)
+			return 0;
+	}
+
+	if (var_cp) {
+		HyperLogLog hll(HyperLogLog::precision_for_error(get_value_count_error()));
+		unsigned var_idx = MinerUtils::get_variables(var_cp).index.at(var);
+		MinerUtils::for_each_grounding(var_cp, db, [&](const HandleSeq& vals) {
+				hll.insert(vals[var_idx]->get_hash()); });
+		return std::lround(hll.estimate());
+	}
+
+	// var has been simplified away, fall back to the exact count
+	Valuations vs(MinerUtils::mk_pattern_no_vardecl(block), db);
+	return vs.values(var).keys().size();
+}
+
+void Surprisingness::set_value_count_error(double error)
+{
+	_value_count_error = std::max(0.0, error);
+}
+
+double Surprisingness::get_value_count_error()
+{
+	return _value_count_error;
+}
+
 HandleCounter Surprisingness::value_distribution(const HandleSeq& block,
                                                  const Handle& var,
                                                  const HandleSeq& db)
@@ -172,18 +408,46 @@ HandleCounter Surprisingness::value_distribution(const HandleSeq& block,
 
 double Surprisingness::inner_product(const std::vector<HandleCounter>& dists)
 {
-	// Find the common intersection of values
-	HandleSet cvals = dists[0].keys();
-	for (size_t i = 1; i < dists.size(); i++)
-		cvals = opencog::set_intersection(cvals, dists[i].keys());
+	if (dists.empty())
+		return 0.0;
+
+	// Walk the other distributions along the smallest one
+	const HandleCounter& smallest = *boost::min_element(dists,
+		[](const HandleCounter& l, const HandleCounter& r) {
+			return l.size() < r.size(); });
+	std::vector<const HandleCounter*> others;
+	for (const HandleCounter& dist : dists)
+		if (&dist != &smallest)
+			others.push_back(&dist);
+
+	// Beyond that size ratio, looking a value up in a distribution is
+	// cheaper than walking it.
+	static const size_t walk_ratio = 8;
+	std::vector<HandleCounter::const_iterator> its;
+	std::vector<bool> walk;
+	for (const HandleCounter* dist : others) {
+		its.push_back(dist->begin());
+		walk.push_back(dist->size() <= walk_ratio * smallest.size());
+	}
 
 	// Calculate the inner product of all distributions across the
 	// common values
 	double p = 0.0;
-	for (const Handle& v : cvals) {
-		double inner = 1.0;
-		for (const HandleCounter& dist : dists)
-			inner *= dist.at(v);
+	for (const auto& vp : smallest) {
+		double inner = vp.second;
+		for (size_t i = 0; i < others.size() and inner != 0.0; i++) {
+			if (walk[i]) {
+				while (its[i] != others[i]->end() and its[i]->first < vp.first)
+					++its[i];
+				if (its[i] == others[i]->end() or vp.first < its[i]->first)
+					inner = 0.0;
+				else
+					inner *= its[i]->second;
+			} else {
+				auto it = others[i]->find(vp.first);
+				inner = it == others[i]->end() ? 0.0 : inner * it->second;
+			}
+		}
 		p += inner;
 	}
 	return p;
@@ -210,6 +474,17 @@ double Surprisingness::emp_prob(const Handle& pattern, const HandleSeq& db)
 	return sup / ucount;
 }
 
+double Surprisingness::emp_prob(const Handle& pattern,
+                                const HandleSeq& db,
+                                const std::vector<unsigned>& indices)
+{
+	double ucount = std::pow((double)indices.size(),
+	                         MinerUtils::n_conjuncts(pattern));
+	unsigned ms = (unsigned)std::min((double)UINT_MAX, ucount);
+	double sup = MinerUtils::support(pattern, db, indices, ms);
+	return sup / ucount;
+}
+
 double Surprisingness::emp_prob_mem(const Handle& pattern, const HandleSeq& db)
 {
 	TruthValuePtr emp_prob_tv = get_emp_tv(pattern);
@@ -230,11 +505,38 @@ double Surprisingness::emp_prob_subsmp(const Handle& pattern,
 	                subsmp(db, subsize) : db);
 }
 
+double Surprisingness::emp_prob_resample(const Handle& pattern,
+                                         const HandleSeq& db,
+                                         unsigned subsize,
+                                         unsigned index)
+{
+	if (db.size() <= subsize)
+		return emp_prob(pattern, db);
+	MT19937RandGen rng(bs_seed(pattern, index));
+	return emp_prob(pattern, db, subsmp_indices(db.size(), subsize, rng));
+}
+
 TruthValuePtr Surprisingness::emp_tv(const Handle& pattern, const HandleSeq& db)
 {
 	double ucount = universe_count(pattern, db);
 	unsigned ms = (unsigned)std::min((double)UINT_MAX, ucount);
 	double sup = MinerUtils::support(pattern, db, ms);
+	return support_to_emp_tv(sup, ucount);
+}
+
+TruthValuePtr Surprisingness::emp_tv(const Handle& pattern,
+                                     const HandleSeq& db,
+                                     const std::vector<unsigned>& indices)
+{
+	double ucount = std::pow((double)indices.size(),
+	                         MinerUtils::n_conjuncts(pattern));
+	unsigned ms = (unsigned)std::min((double)UINT_MAX, ucount);
+	double sup = MinerUtils::support(pattern, db, indices, ms);
+	return support_to_emp_tv(sup, ucount);
+}
+
+TruthValuePtr Surprisingness::support_to_emp_tv(double sup, double ucount)
+{
 	double mean = sup / ucount;
 	double conf = count_to_confidence(ucount);
 	// Hack alert! Lower the confidence because subsampling can
@@ -264,21 +566,138 @@ TruthValuePtr Surprisingness::emp_tv_subsmp(const Handle& pattern,
 	              subsmp(db, subsize) : db);
 }
 
+TruthValuePtr Surprisingness::emp_tv_resample(const Handle& pattern,
+                                              const HandleSeq& db,
+                                              unsigned subsize,
+                                              unsigned index)
+{
+	if (db.size() <= subsize)
+		return emp_tv(pattern, db);
+	MT19937RandGen rng(bs_seed(pattern, index));
+	return emp_tv(pattern, db, subsmp_indices(db.size(), subsize, rng));
+}
+
 double Surprisingness::emp_prob_bs(const Handle& pattern,
                                    const HandleSeq& db,
                                    unsigned n_resample,
                                    unsigned subsize)
 {
 	if (subsize < db.size()) {
-		std::vector<double> essprobs;
-		dorepeat(n_resample)
-			essprobs.push_back(emp_prob_subsmp(pattern, db, subsize));
+		std::vector<double> essprobs(n_resample);
+		MinerUtils::parallel_for(n_resample, get_jobs(), [&](size_t i) {
+				essprobs[i] = emp_prob_resample(pattern, db, subsize, i); });
+		return avrg(essprobs);
+	} else {
+		return emp_prob(pattern, db);
+	}
+}
+
+std::atomic<double> Surprisingness::_bs_tolerance(0.0);
+std::atomic<unsigned> Surprisingness::_max_resamples(10);
+std::atomic<unsigned long> Surprisingness::_bs_seed(0);
+std::atomic<double> Surprisingness::_value_count_error(0.0);
+std::atomic<unsigned> Surprisingness::_max_prtns(0);
+
+void Surprisingness::set_bootstrap_tolerance(double tolerance)
+{
+	_bs_tolerance = std::max(0.0, tolerance);
+}
+
+double Surprisingness::get_bootstrap_tolerance()
+{
+	return _bs_tolerance;
+}
+
+void Surprisingness::set_maximum_resamples(unsigned max_resamples)
+{
+	_max_resamples = std::max(1U, max_resamples);
+}
+
+unsigned Surprisingness::get_maximum_resamples()
+{
+	return _max_resamples;
+}
+
+void Surprisingness::set_bootstrap_seed(unsigned long seed)
+{
+	_bs_seed = seed;
+}
+
+unsigned long Surprisingness::get_bootstrap_seed()
+{
+	return _bs_seed;
+}
+
+unsigned long Surprisingness::bs_seed(const Handle& pattern, unsigned index)
+{
+	size_t seed = get_bootstrap_seed();
+	boost::hash_combine(seed, pattern->get_hash());
+	boost::hash_combine(seed, index);
+	return seed;
+}
+
+unsigned Surprisingness::bs_resample(unsigned max_resamples,
+                                     const std::function<void(size_t)>& resample,
+                                     const std::function<bool(size_t)>& enough)
+{
+	unsigned batch_size = MinerUtils::effective_jobs(get_jobs());
+	size_t n = 0;
+	while (n < max_resamples) {
+		size_t from = n, to = std::min((size_t)max_resamples, n + batch_size);
+		MinerUtils::parallel_for(to - from, batch_size, [&](size_t i) {
+				resample(from + i); });
+		while (n < to)
+			if (enough(++n))
+				return n;
+	}
+	return n;
+}
+
+double Surprisingness::emp_prob_abs(const Handle& pattern,
+                                    const HandleSeq& db,
+                                    unsigned subsize,
+                                    double emin,
+                                    double emax)
+{
+	if (subsize < db.size()) {
+		std::vector<double> essprobs(get_maximum_resamples());
+		auto resample = [&](size_t i) {
+			essprobs[i] = emp_prob_resample(pattern, db, subsize, i);
+		};
+		auto enough = [&](size_t n) {
+			std::vector<double> probs(essprobs.begin(), essprobs.begin() + n);
+			return bs_enough(probs, emin, emax);
+		};
+		essprobs.resize(bs_resample(essprobs.size(), resample, enough));
+		LAZY_MINER_LOG_FINE << "Stopped bootstrapping after "
+		                    << essprobs.size() << " resamples";
 		return avrg(essprobs);
 	} else {
 		return emp_prob(pattern, db);
 	}
 }
 
+bool Surprisingness::bs_enough(const std::vector<double>& probs,
+                               double emin,
+                               double emax)
+{
+	double tolerance = get_bootstrap_tolerance();
+	if (tolerance <= 0 or probs.size() < 2)
+		return false;
+
+	// Calculate the standard error of the mean
+	double n = probs.size();
+	double mean = boost::accumulate(probs, 0.0) / n;
+	double ssd = 0.0;
+	for (double p : probs)
+		ssd += sq(p - mean);
+	double se = std::sqrt(ssd / (n - 1) / n);
+
+	// Stop if accurate enough, or if the mean is within the interval
+	// of estimates with high confidence
+	return se <= tolerance or (emin <= mean - 2*se and mean + 2*se <= emax);
+}
+
 double Surprisingness::emp_prob_pbs(const Handle& pattern,
                                     const HandleSeq& db,
                                     double db_ratio)
@@ -287,7 +706,7 @@ double Surprisingness::emp_prob_pbs(const Handle& pattern,
 		// If there is more than one conjunct, calculate an estimate
 		// first to subsample the db if necessary
 		auto [emin, emax] = ji_prob_est_interval(pattern, db, db_ratio);
-		return emp_prob_pbs(pattern, db, emax, db_ratio);
+		return emp_prob_pbs(pattern, db, emin, emax, db_ratio);
 	} else {
 		// Otherwise, no subsampling is necessary, should be tractable
 		return emp_prob(pattern, db);
@@ -298,11 +717,20 @@ double Surprisingness::emp_prob_pbs(const Handle& pattern,
                                     const HandleSeq& db,
                                     double prob_estimate,
                                     double db_ratio)
+{
+	return emp_prob_pbs(pattern, db, prob_estimate, prob_estimate, db_ratio);
+}
+
+double Surprisingness::emp_prob_pbs(const Handle& pattern,
+                                    const HandleSeq& db,
+                                    double emin,
+                                    double emax,
+                                    double db_ratio)
 {
 	// Calculate an estimate of the support of the pattern to decide
 	// whether we should subsample the db corpus. Indeed some
 	// patterns have intractably large support.
-	double support_estimate = prob_to_support(pattern, db, prob_estimate);
+	double support_estimate = prob_to_support(pattern, db, emax);
 	double db_size = db.size() * db_ratio;
 
 	// If the support estimate is above the db size then we
@@ -313,13 +741,12 @@ double Surprisingness::emp_prob_pbs(const Handle& pattern,
 		              << " > " << db_size << " (its rescaled db size)";
 		// Calculate the empirical probability of pattern
 		unsigned subsize = subsmp_size(pattern, db_size, support_estimate);
-		unsigned n_resample = 10;  // TODO: move this hardwired contant
-		                             // to a user parameter
 		LAZY_MINER_LOG_FINE << "Downsample the db to " << subsize
 		              << " to avoid excessively large support,"
-		              << " boostrapping" << " (x" << n_resample << ")"
+		              << " boostrapping" << " (at most x"
+		              << get_maximum_resamples() << ")"
 		              << " to reduce inaccuracies.";
-		double emp_prob = emp_prob_bs(pattern, db, n_resample, subsize);
+		double emp_prob = emp_prob_abs(pattern, db, subsize, emin, emax);
 		if (emp_prob == 0) {
 			LAZY_MINER_LOG_WARN << "The empirical probability of pattern" << std::endl
 			              << oc_to_string(pattern) << std::endl
@@ -363,15 +790,30 @@ double Surprisingness::emp_prob_pbs_mem(const Handle& pattern,
 	return ep;
 }
 
+double Surprisingness::emp_prob_pbs_mem(const Handle& pattern,
+                                        const HandleSeq& db,
+                                        double emin,
+                                        double emax,
+                                        double db_ratio)
+{
+	TruthValuePtr etv = get_emp_tv(pattern);
+	if (etv) {
+		return etv->get_mean();
+	}
+	double ep = emp_prob_pbs(pattern, db, emin, emax, db_ratio);
+	set_emp_prob(pattern, ep);
+	return ep;
+}
+
 TruthValuePtr Surprisingness::emp_tv_bs(const Handle& pattern,
                                         const HandleSeq& db,
                                         unsigned n_resample,
                                         unsigned subsize)
 {
 	if (subsize < db.size()) {
-		TruthValueSeq esstvs;
-		dorepeat(n_resample)
-			esstvs.push_back(emp_tv_subsmp(pattern, db, subsize));
+		TruthValueSeq esstvs(n_resample);
+		MinerUtils::parallel_for(n_resample, get_jobs(), [&](size_t i) {
+				esstvs[i] = emp_tv_resample(pattern, db, subsize, i); });
 		return avrg_tv(esstvs);
 	} else {
 		TruthValuePtr etv = emp_tv(pattern, db);
@@ -379,6 +821,28 @@ TruthValuePtr Surprisingness::emp_tv_bs(const Handle& pattern,
 	}
 }
 
+TruthValuePtr Surprisingness::emp_tv_abs(const Handle& pattern,
+                                         const HandleSeq& db,
+                                         unsigned subsize)
+{
+	if (subsize < db.size()) {
+		TruthValueSeq esstvs(get_maximum_resamples());
+		auto resample = [&](size_t i) {
+			esstvs[i] = emp_tv_resample(pattern, db, subsize, i);
+		};
+		auto enough = [&](size_t n) {
+			std::vector<double> probs;
+			for (size_t i = 0; i < n; i++)
+				probs.push_back(esstvs[i]->get_mean());
+			return bs_enough(probs, 0.0, 0.0);
+		};
+		esstvs.resize(bs_resample(esstvs.size(), resample, enough));
+		return avrg_tv(esstvs);
+	} else {
+		return emp_tv(pattern, db);
+	}
+}
+
 TruthValuePtr Surprisingness::emp_tv_pbs(const Handle& pattern,
                                          const HandleSeq& db,
                                          double prob_estimate,
@@ -395,9 +859,7 @@ TruthValuePtr Surprisingness::emp_tv_pbs(const Handle& pattern,
 	if (db_size < support_estimate) {
 		// Calculate the empirical probability of pattern
 		unsigned subsize = subsmp_size(pattern, db_size, support_estimate);
-		unsigned n_resample = 10;  // TODO: move this hardwired contant
-		                             // to a user parameter
-		return emp_tv_bs(pattern, db, n_resample, subsize);
+		return emp_tv_abs(pattern, db, subsize);
 	} else {
 		return emp_tv(pattern, db);
 	}
@@ -419,29 +881,53 @@ TruthValuePtr Surprisingness::emp_tv_pbs_mem(const Handle& pattern,
 
 HandleSeq Surprisingness::subsmp(const HandleSeq& db, unsigned subsize)
 {
-	unsigned ts = db.size();
-	if (ts/2 <= subsize and subsize < ts) {
-		// Subsample by randomly removing (swapping all elements to
-		// remove with the tail, then removing the tail, which is
-		// considerably faster than removing element by element).
-		HandleSeq smp_db(db);
-		unsigned i = ts;
-		while (subsize < i) {
-			unsigned rnd_idx = randGen().randint(i);
-			std::swap(smp_db[rnd_idx], smp_db[--i]);
-		}
-		smp_db.resize(i);
-		return smp_db;
-	} else if (0 <= subsize and subsize < ts/*/2*/) {
-		// Subsample by randomly adding
-		HandleSeq smp_db(subsize);
-		lazy_random_selector select(ts);
-		for (size_t i = 0; i < subsize; i++)
-			smp_db[i] = db[select()];
-		return smp_db;
-	} else {
+	// randGen() is shared, serialize its access across threads
+	static std::mutex rand_mtx;
+	std::lock_guard<std::mutex> lock(rand_mtx);
+	return subsmp(db, subsize, randGen());
+}
+
+HandleSeq Surprisingness::subsmp(const HandleSeq& db, unsigned subsize,
+                                 RandGen& rng)
+{
+	if (db.size() <= subsize)
 		return db;
+
+	HandleSeq smp_db;
+	smp_db.reserve(subsize);
+	for (unsigned i : subsmp_indices(db.size(), subsize, rng))
+		smp_db.push_back(db[i]);
+	return smp_db;
+}
+
+std::vector<unsigned> Surprisingness::subsmp_indices(unsigned ts,
+                                                     unsigned subsize,
+                                                     RandGen& rng)
+{
+	std::vector<unsigned> indices;
+	if (ts <= subsize) {
+		indices.resize(ts);
+		std::iota(indices.begin(), indices.end(), 0);
+	} else if (ts/2 <= subsize) {
+		// Subsample by randomly selecting the indices to remove,
+		// fewer than the ones to keep
+		std::vector<bool> removed(ts, false);
+		lazy_random_selector select(ts, rng);
+		for (unsigned i = subsize; i < ts; i++)
+			removed[select()] = true;
+		indices.reserve(subsize);
+		for (unsigned i = 0; i < ts; i++)
+			if (not removed[i])
+				indices.push_back(i);
+	} else {
+		// Subsample by randomly selecting the indices to keep
+		indices.reserve(subsize);
+		lazy_random_selector select(ts, rng);
+		for (unsigned i = 0; i < subsize; i++)
+			indices.push_back(select());
+		boost::sort(indices);
 	}
+	return indices;
 }
 
 unsigned Surprisingness::subsmp_size(const Handle& pattern,
@@ -455,23 +941,94 @@ unsigned Surprisingness::subsmp_size(const Handle& pattern,
 	return std::max((unsigned)res, std::min(min_subsize, (unsigned)db_size));
 }
 
+std::atomic<unsigned> Surprisingness::_jobs(1);
+
+void Surprisingness::set_jobs(unsigned jobs)
+{
+	_jobs = std::max(1U, jobs);
+}
+
+unsigned Surprisingness::get_jobs()
+{
+	return _jobs;
+}
+
+HandleSeqSeq Surprisingness::subpattern_levels(const HandleSeqSeqSeq& prtns,
+                                               const Handle& pattern)
+{
+	return subpattern_levels(std::vector<HandleSeqSeqSeq>{prtns}, {pattern});
+}
+
+HandleSeqSeq Surprisingness::subpattern_levels(const std::vector<HandleSeqSeqSeq>& prtnss,
+                                               const HandleSeq& patterns)
+{
+	std::map<size_t, HandleSet> size2subpats;
+	for (size_t i = 0; i < patterns.size(); i++) {
+		AtomSpace& as = *patterns[i]->getAtomSpace();
+		for (const HandleSeqSeq& partition : prtnss[i])
+			for (const HandleSeq& blk : partition)
+				size2subpats[blk.size()].insert(add_pattern(blk, as));
+	}
+
+	HandleSeqSeq levels;
+	for (const auto& sp : size2subpats)
+		levels.emplace_back(sp.second.begin(), sp.second.end());
+	return levels;
+}
+
 std::pair<double, double> Surprisingness::ji_prob_est_interval(const Handle& pattern,
                                                                const HandleSeq& db,
                                                                double db_ratio)
 {
+	HandleSeqSeqSeq prtns = partitions(pattern);
+
+	// Memoize the empirical probabilities of all subpatterns, each
+	// calculated once, smallest first
+	for (const HandleSeq& level : subpattern_levels(prtns, pattern))
+		MinerUtils::parallel_for(level.size(), get_jobs(), [&](size_t i) {
+				emp_prob_pbs_mem(level[i], db, db_ratio); });
+
 	// Calculate the probability estimate of each partition based on
 	// independent assumption of between each partition block, taking
 	// into account the linkage probability.
-	std::vector<double> estimates;
-	HandleSeqSeqSeq prtns = MinerUtils::partitions_without_pattern(pattern);
-	for (const HandleSeqSeq& partition : prtns) {
-		double jip = ji_prob_est(partition, pattern, db, db_ratio);
-		estimates.push_back(jip);
-	}
+	std::vector<double> estimates(prtns.size());
+	MinerUtils::parallel_for(prtns.size(), get_jobs(), [&](size_t i) {
+			estimates[i] = ji_prob_est(prtns[i], pattern, db, db_ratio); });
 	auto mmp = std::minmax_element(estimates.begin(), estimates.end());
-	double emin = *mmp.first, emax = *mmp.second;
 
-	return {emin, emax};
+	// Widen the interval if only some partitions have been evaluated
+	return widen_interval(pattern, prtns.size(), *mmp.first, *mmp.second);
+}
+
+HandleSeqSeqSeq Surprisingness::partitions(const Handle& pattern)
+{
+	unsigned max_prtns = get_maximum_partitions();
+	if (max_prtns == 0)
+		return MinerUtils::partitions_without_pattern(pattern);
+	MT19937RandGen rng(bs_seed(pattern, std::numeric_limits<unsigned>::max()));
+	return MinerUtils::sample_partitions_without_pattern(pattern, max_prtns, rng);
+}
+
+std::pair<double, double> Surprisingness::widen_interval(const Handle& pattern,
+                                                         size_t n_prtns,
+                                                         double emin,
+                                                         double emax)
+{
+	double total = MinerUtils::bell_number(MinerUtils::n_conjuncts(pattern)) - 1;
+	if (total <= n_prtns)
+		return {emin, emax};
+	double d = (1.0 - n_prtns / total) * (emax - emin) / 2.0;
+	return {std::max(0.0, emin - d), std::min(1.0, emax + d)};
+}
+
+void Surprisingness::set_maximum_partitions(unsigned max_prtns)
+{
+	_max_prtns = max_prtns;
+}
+
+unsigned Surprisingness::get_maximum_partitions()
+{
+	return _max_prtns;
 }
 
 double Surprisingness::ji_prob_est(const HandleSeqSeq& partition,
@@ -539,12 +1096,14 @@ TruthValuePtr Surprisingness::ji_tv_est(const Handle& pattern,
 	// Calculate the truth value estimate of each partition based on
 	// independent assumption of between each partition block, taking
 	// into account the linkage probability.
-	TruthValueSeq etvs;
-	HandleSeqSeqSeq prtns = MinerUtils::partitions_without_pattern(pattern);
-	for (const HandleSeqSeq& partition : prtns) {
-		TruthValuePtr etv = ji_tv_est(partition, pattern, db);
-		etvs.push_back(etv);
-	}
+	HandleSeqSeqSeq prtns = partitions(pattern);
+	for (const HandleSeq& level : subpattern_levels(prtns, pattern))
+		MinerUtils::parallel_for(level.size(), get_jobs(), [&](size_t i) {
+				emp_tv_mem(level[i], db); });
+
+	TruthValueSeq etvs(prtns.size());
+	MinerUtils::parallel_for(prtns.size(), get_jobs(), [&](size_t i) {
+			etvs[i] = ji_tv_est(prtns[i], pattern, db); });
 	return avrg_tv(etvs);
 }
 
@@ -696,25 +1255,69 @@ void Surprisingness::set_ji_tv_est(const Handle& pattern, TruthValuePtr jte)
 
 double Surprisingness::jsd(TruthValuePtr l_tv, TruthValuePtr r_tv)
 {
-	static int bins = 100;
-	BetaDistribution l_bd(l_tv);
-	BetaDistribution r_bd(r_tv);
-	std::vector<double>
-		l_cdf = l_bd.cdf(bins),
-		r_cdf = r_bd.cdf(bins),
-		m_cdf = avrg_cdf(l_cdf, r_cdf);
-	double
-		ld = kld(l_cdf, m_cdf),
-		rd = kld(r_cdf, m_cdf);
-
 	// logger().debug() << "CSV representation of the pdf of the left TV. ";
-	// log_pdf(l_bd, bins);
+	// log_pdf(BetaDistribution(l_tv), 100);
 	// logger().debug() << "CSV representation of the pdf of the right TV. ";
-	// log_pdf(r_bd, bins);
+	// log_pdf(BetaDistribution(r_tv), 100);
+
+	return jsd(*beta_cdf(l_tv), *beta_cdf(r_tv));
+}
 
+double Surprisingness::jsd(const std::vector<double>& l_cdf,
+                           const std::vector<double>& r_cdf)
+{
+	static double epsilon = 1e-32;
+	OC_ASSERT(l_cdf.size() == r_cdf.size());
+
+	// Same as kld(l_cdf, m_cdf) and kld(r_cdf, m_cdf) where m_cdf is
+	// avrg_cdf(l_cdf, r_cdf), the probability of each data point of
+	// m_cdf being the average of those of l_cdf and r_cdf.
+	double last_lv = 0.0, last_rv = 0.0, ld = 0.0, rd = 0.0;
+	for (size_t i = 0; i < l_cdf.size(); i++) {
+		double lp = l_cdf[i] - last_lv;
+		double rp = r_cdf[i] - last_rv;
+		double mp = avrg(lp, rp);
+		if (epsilon < mp) {
+			if (epsilon < lp)
+				ld += lp * std::log2(lp/mp);
+			if (epsilon < rp)
+				rd += rp * std::log2(rp/mp);
+		}
+		last_lv = l_cdf[i];
+		last_rv = r_cdf[i];
+	}
 	return sqrt(avrg(ld, rd));
 }
 
+std::shared_ptr<const std::vector<double>>
+Surprisingness::beta_cdf(const TruthValuePtr& tv)
+{
+	typedef std::shared_ptr<const std::vector<double>> CdfPtr;
+	static const int bins = 100;
+	static const size_t max_cdfs = 10000;
+	static std::map<std::pair<double, double>, CdfPtr> cdfs;
+	static std::mutex mtx;
+
+	std::pair<double, double> key(tv->get_mean(), tv->get_count());
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		auto it = cdfs.find(key);
+		if (it != cdfs.end())
+			return it->second;
+	}
+
+	// Calculate outside of the lock, a concurrent call may calculate
+	// the same cdf, which is harmless.
+	CdfPtr cdf = std::make_shared<const std::vector<double>>(
+		BetaDistribution(tv).cdf(bins));
+
+	std::lock_guard<std::mutex> lock(mtx);
+	if (max_cdfs <= cdfs.size())
+		cdfs.clear();
+	cdfs.emplace(key, cdf);
+	return cdf;
+}
+
 double Surprisingness::kld(const std::vector<double>& l_cdf,
                            const std::vector<double>& r_cdf)
 {
@@ -23,14 +23,23 @@
 #ifndef OPENCOG_SURPRISINGNESS_H_
 #define OPENCOG_SURPRISINGNESS_H_
 
+#include <opencog/util/RandGen.h>
 #include <opencog/atoms/base/Handle.h>
 #include <opencog/atoms/core/LambdaLink.h>
 #include <opencog/atomspace/AtomSpace.h>
 #include <opencog/ure/BetaDistribution.h>
 
+#include "MinerUtils.h"
+
+#include <atomic>
+#include <functional>
+#include <memory>
+
 namespace opencog
 {
 
+class Miner;
+
 /**
  * Collection of tools to calculate pattern surprisingness.
  */
@@ -337,6 +346,76 @@ public:
 	                    bool normalize=true,
 	                    double db_ratio=1.0);
 
+	/**
+	 * Like isurp but over multiple patterns at once. The distinct
+	 * subpatterns across the partitions of all patterns are evaluated
+	 * once, level by level, then the interval and the empirical
+	 * probability of each pattern are calculated. Work within each
+	 * step is distributed over get_jobs() threads.
+	 *
+	 * Return a vector of the same size as patterns, with the
+	 * I-Surprisingness of each pattern.
+	 */
+	static std::vector<double> isurp_batch(const HandleSeq& patterns,
+	                                       const HandleSeq& db,
+	                                       bool normalize=true,
+	                                       double db_ratio=1.0);
+
+	/**
+	 * Return an upper bound of the I-Surprisingness of pattern,
+	 * obtained from its empirical probability and the probability
+	 * estimate of its partition into singletons alone.
+	 *
+	 * Since that estimate lies within the interval of estimates of
+	 * all partitions, the distance between the empirical probability
+	 * and it cannot be lower than the distance to the interval. The
+	 * empirical probabilities calculated here are memoized and thus
+	 * reused if the pattern gets fully scored afterwards.
+	 */
+	static double isurp_upper_bound(const Handle& pattern,
+	                                const HandleSeq& db,
+	                                bool normalize=true,
+	                                double db_ratio=1.0);
+
+	/**
+	 * Return the k patterns with the highest I-Surprisingness,
+	 * alongside their scores, in decreasing order.
+	 *
+	 * Patterns are visited by decreasing isurp_upper_bound and fully
+	 * scored with isurp_batch, get_jobs() at a time, into a bounded
+	 * heap of the k best scores. The search stops as soon as the
+	 * upper bound of the next pattern cannot beat the lowest score
+	 * of a full heap, sparing the cost of evaluating all partitions
+	 * of the remaining patterns.
+	 */
+	static std::vector<std::pair<Handle, double>> isurp_top_k(const HandleSeq& patterns,
+	                                                          const HandleSeq& db,
+	                                                          unsigned k,
+	                                                          bool normalize=true,
+	                                                          double db_ratio=1.0);
+
+	/**
+	 * Mine db with miner, as Miner::native_mine does, while scoring
+	 * the mined patterns with isurp. Each pattern of more than one
+	 * conjunct is copied into as and pushed into a bounded queue as
+	 * soon as it passes the minimum support, then popped and scored
+	 * by get_jobs() worker threads while mining goes on. At most
+	 * queue_size patterns wait to be scored at any time, blocking the
+	 * miner if the workers lag behind.
+	 *
+	 * If get_jobs() is 1, or if called from within a worker thread,
+	 * then mining and scoring are run one after the other instead.
+	 *
+	 * Return the scored patterns, as copied in as, alongside their
+	 * I-Surprisingness, in no particular order.
+	 */
+	static std::vector<std::pair<Handle, double>> pipelined_isurp(Miner& miner,
+	                                                              const HandleSeq& db,
+	                                                              AtomSpace& as,
+	                                                              bool normalize=true,
+	                                                              double db_ratio=1.0,
+	                                                              size_t queue_size=1024);
+
 	/**
 	 * Return the distance between a value and an interval
 	 *
@@ -396,11 +475,32 @@ public:
 	/**
 	 * Return the number values (groundings) associated to a given variable in a
 	 * block (subpatterns) w.r.t. to db.
+	 *
+	 * If the value count error is positive, the count is estimated by
+	 * approx_value_count instead.
 	 */
 	static unsigned value_count(const HandleSeq& block,
 	                            const Handle& var,
 	                            const HandleSeq& db);
 
+	/**
+	 * Like value_count but estimate the number of distinct values
+	 * with a HyperLogLog sketch fed by the groundings of the
+	 * component of the block containing var, as they are found,
+	 * without building its valuations or satisfying set. Return 0 if
+	 * another component of the block has no grounding.
+	 */
+	static unsigned approx_value_count(const HandleSeq& block,
+	                                   const Handle& var,
+	                                   const HandleSeq& db);
+
+	/**
+	 * Set/get the relative standard error tolerated on value
+	 * counts. The default, 0, means exact counts.
+	 */
+	static void set_value_count_error(double error);
+	static double get_value_count_error();
+
 	/**
 	 * Return the probability distribution over value of var in the
 	 * given subpattern/block against a given database.
@@ -426,6 +526,11 @@ public:
 	 * + 0*0.3      // C
 	 * + 0*0.3      // D
 	 * = 0.2
+	 *
+	 * Since distributions are ordered by value, the common values are
+	 * found by walking all distributions along the smallest one, in a
+	 * single sorted merge. Distributions much larger than the
+	 * smallest one are looked up instead of walked.
 	 */
 	static double inner_product(const std::vector<HandleCounter>& dists);
 
@@ -448,6 +553,14 @@ public:
 	 */
 	static double emp_prob(const Handle& pattern, const HandleSeq& db);
 
+	/**
+	 * Like above but only over the data trees of db at the given
+	 * indices, see subsmp_indices.
+	 */
+	static double emp_prob(const Handle& pattern,
+	                       const HandleSeq& db,
+	                       const std::vector<unsigned>& indices);
+
 	/**
 	 * Like emp_prob with memoization.
 	 */
@@ -462,16 +575,99 @@ public:
 	                              const HandleSeq& db,
 	                              unsigned subsize=UINT_MAX);
 
+	/**
+	 * Like emp_prob_subsmp but the subsample is drawn from its own
+	 * random generator, seeded with bs_seed(pattern, index), so that
+	 * resamples are reproducible and can be calculated concurrently.
+	 */
+	static double emp_prob_resample(const Handle& pattern,
+	                                const HandleSeq& db,
+	                                unsigned subsize,
+	                                unsigned index);
+
 	/**
 	 * Like emp_prob but uses bootstrapping for more
 	 * efficiency. n_resample is the number of subsamplings taking
 	 * place, and subsize is the size of each subsample.
+	 *
+	 * Resamples are calculated over get_jobs() threads, each with
+	 * its own random generator, see emp_prob_resample, thus the
+	 * result does not depend on the number of threads.
 	 */
 	static double emp_prob_bs(const Handle& pattern,
 	                          const HandleSeq& db,
 	                          unsigned n_resample,
 	                          unsigned subsize);
 
+	/**
+	 * Set/get the parameters of the adaptive bootstrapping used by
+	 * emp_prob_pbs and emp_tv_pbs.
+	 *
+	 * Resampling stops as soon as the standard error of the mean
+	 * estimate falls below the tolerance, or after the maximum number
+	 * of resamples. A tolerance of 0, the default, disables early
+	 * stopping, thus the maximum number of resamples, 10 by default,
+	 * is always taken.
+	 */
+	static void set_bootstrap_tolerance(double tolerance);
+	static double get_bootstrap_tolerance();
+	static void set_maximum_resamples(unsigned max_resamples);
+	static unsigned get_maximum_resamples();
+
+	/**
+	 * Set/get the seed from which the seeds of the random generators
+	 * of all resamples are derived, see bs_seed. Default is 0.
+	 */
+	static void set_bootstrap_seed(unsigned long seed);
+	static unsigned long get_bootstrap_seed();
+
+	/**
+	 * Return the seed of the random generator of the resample of
+	 * pattern with the given index, derived from the bootstrap seed,
+	 * the hash of pattern and that index.
+	 */
+	static unsigned long bs_seed(const Handle& pattern, unsigned index);
+
+	/**
+	 * Call resample(i) for i = 0, 1, ..., up to max_resamples, and
+	 * return the first n such that enough(n) is true (or
+	 * max_resamples). Resamples are calculated in parallel by batches
+	 * of get_jobs(), but enough is called in order, so that n does not
+	 * depend on the number of threads (though some resamples beyond n
+	 * may have been calculated).
+	 */
+	static unsigned bs_resample(unsigned max_resamples,
+	                            const std::function<void(size_t)>& resample,
+	                            const std::function<bool(size_t)>& enough);
+
+	/**
+	 * Like emp_prob_bs but the number of resamples is adaptive (abs
+	 * stands for adaptive bootstrapping), see bs_enough.
+	 */
+	static double emp_prob_abs(const Handle& pattern,
+	                           const HandleSeq& db,
+	                           unsigned subsize,
+	                           double emin,
+	                           double emax);
+
+	/**
+	 * Given the probabilities obtained so far by bootstrapping,
+	 * return true iff resampling can stop, that is if the tolerance
+	 * is positive, and either
+	 *
+	 * 1. the standard error of their mean is below the tolerance, or
+	 *
+	 * 2. their mean, plus or minus twice its standard error, lies
+	 *    within [emin, emax], the interval of probability estimates
+	 *    of the pattern, in which case its I-Surprisingness is 0
+	 *    regardless of the exact probability.
+	 *
+	 * At least 2 probabilities are required.
+	 */
+	static bool bs_enough(const std::vector<double>& probs,
+	                      double emin,
+	                      double emax);
+
 	/**
 	 * Calculate the empirical probability of the given pattern,
 	 * possibly boostrapping if necessary. The heuristic to determine
@@ -483,6 +679,10 @@ public:
 	 * prob_estimate is automatically inferred. This takes additional
 	 * computation.
 	 *
+	 * In the version taking an interval of probability estimates,
+	 * [emin, emax], emax is used as probability estimate, and the
+	 * interval is used to stop bootstrapping early, see bs_enough.
+	 *
 	 * pbs stands for possibly boostrapping.
 	 */
 	static double emp_prob_pbs(const Handle& pattern,
@@ -492,6 +692,11 @@ public:
 	                           const HandleSeq& db,
 	                           double prob_estimate,
 	                           double db_ratio);
+	static double emp_prob_pbs(const Handle& pattern,
+	                           const HandleSeq& db,
+	                           double emin,
+	                           double emax,
+	                           double db_ratio);
 
 	/**
 	 * Like emp_prob_pbs with memoization.
@@ -503,12 +708,26 @@ public:
 	                               const HandleSeq& db,
 	                               double prob_estimate,
 	                               double db_ratio);
+	static double emp_prob_pbs_mem(const Handle& pattern,
+	                               const HandleSeq& db,
+	                               double emin,
+	                               double emax,
+	                               double db_ratio);
 
 	/**
 	 * Calculate the empirical truth value of a pattern according to a
 	 * database db.
 	 */
 	static TruthValuePtr emp_tv(const Handle& pattern, const HandleSeq& db);
+	static TruthValuePtr emp_tv(const Handle& pattern,
+	                            const HandleSeq& db,
+	                            const std::vector<unsigned>& indices);
+
+	/**
+	 * Build the empirical truth value of a pattern given its support
+	 * and its universe count.
+	 */
+	static TruthValuePtr support_to_emp_tv(double sup, double ucount);
 
 	/**
 	 * Like emp_tv with memoization.
@@ -524,6 +743,14 @@ public:
 	                                   const HandleSeq& db,
 	                                   unsigned subsize=UINT_MAX);
 
+	/**
+	 * Like emp_prob_resample but return a truth value.
+	 */
+	static TruthValuePtr emp_tv_resample(const Handle& pattern,
+	                                     const HandleSeq& db,
+	                                     unsigned subsize,
+	                                     unsigned index);
+
 	/**
 	 * Like emp_tv but uses bootstrapping for more
 	 * efficiency. n_resample is the number of subsamplings taking
@@ -534,6 +761,14 @@ public:
 	                               unsigned n_resample,
 	                               unsigned subsize);
 
+	/**
+	 * Like emp_tv_bs but the number of resamples is adaptive, see
+	 * bs_enough (no interval of probability estimates is used).
+	 */
+	static TruthValuePtr emp_tv_abs(const Handle& pattern,
+	                                const HandleSeq& db,
+	                                unsigned subsize);
+
 	/**
 	 * Calculate the empirical truth value of the given pattern,
 	 * possibly bootstrapping if necessary. The heuristic to determine
@@ -562,6 +797,21 @@ public:
 	 */
 	static HandleSeq subsmp(const HandleSeq& db, unsigned subsize);
 
+	/**
+	 * Like above but draw from the given random generator.
+	 */
+	static HandleSeq subsmp(const HandleSeq& db, unsigned subsize,
+	                        RandGen& rng);
+
+	/**
+	 * Randomly subsample the indices of a db of size ts so that the
+	 * result has size subsize (or ts if subsize is greater). The
+	 * indices are returned in increasing order. This avoids copying
+	 * db, which remains shared by all resamples.
+	 */
+	static std::vector<unsigned> subsmp_indices(unsigned ts, unsigned subsize,
+	                                            RandGen& rng);
+
 	/**
 	 * Determine the number of samples and the subsample size given a
 	 * database. The goal here to subsample so that the support does
@@ -602,9 +852,74 @@ public:
 	                            double support_estimate,
 	                            unsigned min_subsize=10U);
 
+	/**
+	 * Set/get the number of threads used to evaluate the partitions of
+	 * a pattern concurrently. The default, 1, evaluates them serially.
+	 */
+	static void set_jobs(unsigned jobs);
+	static unsigned get_jobs();
+
+	/**
+	 * Return the distinct subpatterns of all blocks of the given
+	 * partitions of pattern, added to the atomspace of pattern,
+	 * grouped by number of conjuncts in increasing order. Since every
+	 * subset of clauses of a pattern is a block of some of its
+	 * partitions, evaluating the groups in that order guaranties that
+	 * the subpatterns of a block are already memoized by the time
+	 * that block is evaluated.
+	 */
+	static HandleSeqSeq subpattern_levels(const HandleSeqSeqSeq& prtns,
+	                                      const Handle& pattern);
+
+	/**
+	 * Like above but over the partitions of multiple patterns,
+	 * prtnss[i] being the partitions of patterns[i]. Subpatterns
+	 * shared across patterns only appear once.
+	 */
+	static HandleSeqSeq subpattern_levels(const std::vector<HandleSeqSeqSeq>& prtnss,
+	                                      const HandleSeq& patterns);
+
+	/**
+	 * Set/get the maximum number of partitions evaluated per
+	 * pattern. The default, 0, means all of them.
+	 */
+	static void set_maximum_partitions(unsigned max_prtns);
+	static unsigned get_maximum_partitions();
+
+	/**
+	 * Return the partitions of pattern to evaluate, that is all of
+	 * them, or, if get_maximum_partitions() is positive, a sample
+	 * obtained by MinerUtils::sample_partitions_without_pattern,
+	 * seeded from the bootstrap seed and the pattern hash.
+	 */
+	static HandleSeqSeqSeq partitions(const Handle& pattern);
+
+	/**
+	 * Given the interval [emin, emax] of probability estimates
+	 * obtained over n_prtns partitions of pattern, widen it to
+	 * account for the partitions that have not been evaluated. Each
+	 * bound is moved by (1 - f) * (emax - emin) / 2, where f is the
+	 * fraction of partitions evaluated, and clipped to [0, 1].
+	 *
+	 * This is a heuristic, not a bound: the estimates of the
+	 * partitions left out may lie anywhere in [0, 1], and an interval
+	 * reduced to a point (emin == emax) is not widened at all.
+	 */
+	static std::pair<double, double> widen_interval(const Handle& pattern,
+	                                                size_t n_prtns,
+	                                                double emin,
+	                                                double emax);
+
 	/**
 	 * Calculate min and max probability estimates of a pattern by
-	 * applying ji_prob_est over all its possible partitions.
+	 * applying ji_prob_est over all its possible partitions (or a
+	 * sample of them, see partitions and widen_interval).
+	 *
+	 * The empirical probabilities of the distinct subpatterns are
+	 * calculated first, each once, level by level, then the
+	 * partitions are evaluated. Both steps are distributed over
+	 * get_jobs() threads. The estimates are reduced in partition
+	 * order so the result does not depend on the number of threads.
 	 */
 	static std::pair<double, double> ji_prob_est_interval(const Handle& pattern,
 	                                                      const HandleSeq& db,
@@ -735,6 +1050,23 @@ public:
 	 */
 	static double jsd(TruthValuePtr l_tv, TruthValuePtr r_tv);
 
+	/**
+	 * Like above but given the cdfs of the 2 distributions, see
+	 * kld. The cdf of their average and both Kullback-Leibler
+	 * divergences are calculated in a single pass, without
+	 * allocation.
+	 */
+	static double jsd(const std::vector<double>& l_cdf,
+	                  const std::vector<double>& r_cdf);
+
+	/**
+	 * Return the cdf over 100 bins of the Beta distribution of tv,
+	 * as used by jsd. Since the TVs compared by jsd often repeat, the
+	 * cdfs are memoized by mean and count, which fully determine the
+	 * Beta distribution.
+	 */
+	static std::shared_ptr<const std::vector<double>> beta_cdf(const TruthValuePtr& tv);
+
 	/**
 	 * Given 2 cdfs (cummulative distribution functions) return their
 	 * Kullback-Leibler divergence.
@@ -784,6 +1116,14 @@ public:
 	 * number of bins.
 	 */
 	static void log_pdf(const BetaDistribution& bd, int bins);
+
+private:
+	static std::atomic<unsigned> _jobs;
+	static std::atomic<double> _bs_tolerance;
+	static std::atomic<unsigned> _max_resamples;
+	static std::atomic<unsigned long> _bs_seed;
+	static std::atomic<double> _value_count_error;
+	static std::atomic<unsigned> _max_prtns;
 };
 
 } // ~namespace opencog
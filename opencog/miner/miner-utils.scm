@@ -47,6 +47,11 @@
 (define default-maximum-cnjexp-variables 2)
 (define default-surprisingness 'isurp)
 (define default-db-ratio 1)
+(define default-bootstrap-tolerance 0)
+(define default-maximum-resamples 10)
+(define default-value-count-error 0)
+(define default-maximum-partitions 0)
+(define default-top-k 0)
 
 ;; For some crazy reason I need to repaste absolutely-true here while
 ;; it is already defined in ure.
@@ -101,6 +106,13 @@
 "
   (sort lst greater-tv-strength))
 
+(define (take-at-most k lst)
+"
+  Return the first k elements of lst, or lst itself if it has fewer
+  than k elements or if k is not positive.
+"
+  (if (< 0 k (length lst)) (take lst k) lst))
+
 (define (random-db-cpt)
 "
   Create a random Concept node for adding data tree members
@@ -299,6 +311,42 @@
              (jsd-def (Define jsd-alias (gen-jsd-rule))))
         (ure-add-rules surp-rbs (list emp-alias est-alias jsd-alias)))))
 
+(define* (run-surprisingness patterns mode maximum-conjuncts db-cpt db-ratio
+                             #:optional (top-k 0))
+"
+  Calculate the surprisingness of the given set of patterns with
+  respect to db-cpt, and return a list of evaluations
+
+  Evaluation (stv <surprisingness> 1)
+    Predicate mode
+    List
+      <pattern>
+      db-cpt
+
+  For isurp and nisurp all patterns are scored at once so that their
+  common subpatterns are only evaluated once. If top-k is positive,
+  only the top-k most surprising patterns are returned, and patterns
+  whose surprisingness upper bound cannot make it to the top-k are not
+  fully scored. For the other modes the surprisingness rules are run
+  in a backward way, and top-k is ignored.
+"
+  (cond ((and (< 0 top-k) (or (equal? mode 'isurp) (equal? mode 'nisurp)))
+         (let ((top-k-op (if (equal? mode 'isurp) cog-isurp-top-k cog-nisurp-top-k)))
+           (cog-outgoing-set (top-k-op patterns db-cpt (Number top-k) (Number db-ratio)))))
+        ((or (equal? mode 'isurp) (equal? mode 'nisurp))
+         (let ((batch-op (if (equal? mode 'isurp) cog-isurp-batch cog-nisurp-batch)))
+           (cog-outgoing-set (batch-op patterns db-cpt (Number db-ratio)))))
+        (else
+         (let* (;; Configure surprisingness backward chainer
+                (surp-rbs (random-surprisingness-rbs-cpt))
+                (target (surp-target mode db-cpt))
+                (vardecl (surp-vardecl))
+                (cfg-s (configure-surprisingness surp-rbs mode maximum-conjuncts db-ratio))
+
+                ;; Run surprisingness in a backward way
+                (surp-res (cog-bc surp-rbs target #:vardecl vardecl)))
+           (cog-outgoing-set surp-res)))))
+
 (define (pattern-var)
   (Variable "$pattern"))
 
@@ -534,6 +582,32 @@
 "
   (if (number? n) (Number n) n))
 
+(define (set-surprisingness-settings! jobs tolerance resamples error partitions)
+"
+  Set the surprisingness settings, see cog-mine for their meaning.
+"
+  (cog-set-surprisingness-jobs! (to-number-node jobs))
+  (cog-set-surprisingness-bootstrap! (to-number-node tolerance)
+                                     (to-number-node resamples))
+  (cog-set-surprisingness-value-count-error! (to-number-node error))
+  (cog-set-surprisingness-maximum-partitions! (to-number-node partitions)))
+
+(define (with-surprisingness-settings settings thunk)
+"
+  Call thunk with the given surprisingness settings, that is a list
+  of the jobs, bootstrap tolerance, maximum resamples, value count
+  error and maximum partitions. The previous settings are restored
+  when thunk exits, normally or not, as they are process-wide.
+"
+  (let ((previous '()))
+    (dynamic-wind
+      (lambda ()
+        (set! previous (cog-outgoing-set (cog-surprisingness-settings)))
+        (apply set-surprisingness-settings! settings))
+      thunk
+      (lambda ()
+        (apply set-surprisingness-settings! previous)))))
+
 (define* (cog-mine db
                    #:key
                    ;; Number of jobs to run in parallel
@@ -592,7 +666,22 @@
                    (surprisingness default-surprisingness)
 
 		   ;; db-ratio
-		   (db-ratio default-db-ratio))
+		   (db-ratio default-db-ratio)
+
+                   ;; Tolerance of the adaptive bootstrapping
+                   (bootstrap-tolerance default-bootstrap-tolerance)
+
+                   ;; Maximum number of resamples of the bootstrapping
+                   (maximum-resamples default-maximum-resamples)
+
+                   ;; Relative error tolerated on value counts
+                   (value-count-error default-value-count-error)
+
+                   ;; Maximum number of partitions per pattern
+                   (maximum-partitions default-maximum-partitions)
+
+                   ;; Number of most surprising patterns to return
+                   (top-k default-top-k))
 "
   Mine patterns in db (data trees, a.k.a. grounded hypergraphs) with minimum
   support ms, optionally using mi iterations and starting from the initial
@@ -612,7 +701,12 @@
                    #:maximum-spcial-conjuncts mspc  (or #:maxspcjn mspc)
                    #:maximum-cnjexp-variables mcev  (or #:maxcevar mcev)
                    #:surprisingness su              (or #:surp su)
-                   #:db-ratio dbr)
+                   #:db-ratio dbr
+                   #:bootstrap-tolerance bt
+                   #:maximum-resamples mr
+                   #:value-count-error vce
+                   #:maximum-partitions mp
+                   #:top-k tk)
 
   db: Collection of data trees to mine. It can be given in 3 forms
 
@@ -642,7 +736,9 @@
   jb: [optional, default=1] Number of jobs to run in parallel. Can
       speed up mining. Note that this may alter the results especially
       if conjunction expansion if used as its results depends on the output
-      of other mining rules.
+      of other mining rules. It is also the number of threads used to
+      evaluate the partitions of a pattern when calculating its
+      surprisingness.
 
   ms: [optional, default=10] Minimum support. All patterns with count below
       ms are discarded. Can be a Scheme number or an Atomese number node.
@@ -754,6 +850,45 @@
        pattern will be missed, however their surprisingness measures might be
        inaccurate.
 
+  bt: [optional, default=0] Tolerance of the bootstrapping taking place
+      when the dataset is downsampled to estimate the empirical probability
+      of a pattern. Resampling stops as soon as the standard error of
+      the estimate falls below bt, or as soon as the estimate clearly
+      lies within the interval of probability estimates of the pattern,
+      in which case its I-Surprisingness is 0 anyway. A value of 0
+      disables early stopping.
+
+  mr: [optional, default=10] Maximum number of resamples of the
+      bootstrapping described above.
+
+  vce: [optional, default=0] Relative error tolerated when counting the
+       number of values a variable takes, used by isurp and nisurp to
+       estimate the probability that joint variables are equal. If
+       positive, counts are estimated with a HyperLogLog sketch, which
+       is much cheaper for variables with many values on large
+       datasets. If 0, counts are exact.
+
+  mp: [optional, default=0] Maximum number of partitions evaluated per
+      pattern by isurp and nisurp. A pattern of n conjuncts has Bell(n)-1
+      partitions, that is 877 for 7 conjuncts and 21146 for 9. If
+      positive and exceeded, only the partition into singletons,
+      followed by partitions into 2 blocks, all of them if they fit,
+      and a random sample of the others, up to mp in total, are
+      evaluated. The interval of probability estimates is then
+      heuristically widened, in proportion of its width and of the
+      partitions left out, which does not guarantee that it contains
+      the estimates of these partitions. If 0, all partitions are
+      evaluated.
+
+  tk: [optional, default=0] If positive, only return the tk most
+      surprising patterns. With isurp and nisurp, an upper bound of the
+      surprisingness of each pattern is first calculated from its
+      empirical probability and the estimate of its partition into
+      singletons, and patterns whose upper bound cannot enter the top
+      tk are not fully scored, which can save most of the surprisingness
+      cost. With other measures all patterns are scored and the first
+      tk are kept. If 0, all patterns are returned.
+
   Under the hood it will create a rule base and a query for the rule
   engine, configure it according to the user's options and run it.
   Everything takes place in a child atomspace. After the job is done
@@ -985,18 +1120,16 @@
 
               ;; Run surprisingness
               (let*
-                  ;; Configure surprisingness backward chainer
                   ((dummy (miner-logger-debug "Call surprisingness on mined patterns"))
-
-		   (surp-rbs (random-surprisingness-rbs-cpt))
-                   (target (surp-target su db-cpt))
-                   (vardecl (surp-vardecl))
-                   (cfg-s (configure-surprisingness surp-rbs su mc db-ratio))
-
-                   ;; Run surprisingness in a backward way
-                   (surp-res (cog-bc surp-rbs target #:vardecl vardecl))
-                   (surp-res-lst (cog-outgoing-set surp-res))
-                   (surp-res-sort-lst (desc-sort-by-tv-strength surp-res-lst))
+                   (surp-res-lst (with-surprisingness-settings
+                                  (list jobs bootstrap-tolerance
+                                        maximum-resamples value-count-error
+                                        maximum-partitions)
+                                  (lambda ()
+                                    (run-surprisingness patterns su mc db-cpt
+                                                        db-ratio top-k))))
+                   (surp-res-sort-lst (take-at-most top-k
+                                        (desc-sort-by-tv-strength surp-res-lst)))
 
                    ;; Copy the results to the parent atomspace
                    (parent-surp-res (cog-cp parent-as surp-res-sort-lst)))
@@ -1004,6 +1137,308 @@
                 (cog-set-atomspace! parent-as)
                 parent-surp-res))))))
 
+(define* (cog-mine-native db
+                          #:key
+                          ;; Number of jobs to run in parallel
+                          (jobs default-jobs)
+
+                          ;; Minimum support
+                          (minsup default-minimum-support)
+                          (minimum-support default-minimum-support)
+
+                          ;; Minimum frequency
+                          (minfreq default-minimum-frequency)
+                          (minimum-frequency default-minimum-frequency)
+
+                          ;; Initial pattern
+                          (initpat default-initial-pattern)
+                          (initial-pattern default-initial-pattern)
+
+                          ;; Maximum number of iterations
+                          (maxiter default-maximum-iterations)
+                          (maximum-iterations default-maximum-iterations)
+
+                          ;; Complexity penalty, no effect
+                          (cpxpnlt default-complexity-penalty)
+                          (complexity-penalty default-complexity-penalty)
+
+                          ;; Conjunction expansion
+                          (cnjexp default-conjunction-expansion)
+                          (conjunction-expansion default-conjunction-expansion)
+
+                          ;; Enforce specialization
+                          (enfspec default-enforce-specialization)
+                          (enforce-specialization default-enforce-specialization)
+
+                          ;; Maximum number of conjunctions
+                          (maxcnj default-maximum-conjuncts)
+                          (max-conjuncts default-maximum-conjuncts)
+                          (maximum-conjuncts default-maximum-conjuncts)
+
+                          ;; Maximum number of variables
+                          (maxvar default-maximum-variables)
+                          (max-variables default-maximum-variables)
+                          (maximum-variables default-maximum-variables)
+
+                          ;; Maximum number of conjuncts specialization can be applied to
+                          (maxspcjn default-maximum-spcial-conjuncts)
+                          (max-spcial-conjuncts default-maximum-spcial-conjuncts)
+                          (maximum-spcial-conjuncts default-maximum-spcial-conjuncts)
+
+                          ;; Maximum number of variables in conjunction expansion
+                          (maxcevar default-maximum-cnjexp-variables)
+                          (max-cnjexp-variables default-maximum-cnjexp-variables)
+                          (maximum-cnjexp-variables default-maximum-cnjexp-variables)
+
+                          ;; Surprisingness, none by default
+                          (surp 'none)
+                          (surprisingness 'none)
+
+                          ;; db-ratio
+                          (db-ratio default-db-ratio)
+
+                          ;; Tolerance of the adaptive bootstrapping
+                          (bootstrap-tolerance default-bootstrap-tolerance)
+
+                          ;; Maximum number of resamples of the bootstrapping
+                          (maximum-resamples default-maximum-resamples)
+
+                          ;; Relative error tolerated on value counts
+                          (value-count-error default-value-count-error)
+
+                          ;; Maximum number of partitions per pattern
+                          (maximum-partitions default-maximum-partitions)
+
+                          ;; Number of most surprising patterns to return
+                          (top-k default-top-k)
+
+                          ;; Wall-clock time and memory budgets
+                          (maximum-time -1)
+                          (maximum-memory 0)
+
+                          ;; Which frequent patterns to return
+                          (mode 'all)
+
+                          ;; Checkpointing
+                          (checkpoint #f)
+                          (checkpoint-interval 10)
+                          (resume #f))
+"
+  Like cog-mine but mining natively instead of running the URE
+  forward chainer. It is much faster as it does not have to unify
+  rules, keep track of minsup evaluations or fetch patterns with a
+  query.
+
+  Usage: (cog-mine-native db
+                          #:jobs jb
+                          #:minimum-support ms             (or #:minsup ms)
+                          #:minimum-frequency mf           (or #:minfreq mf)
+                          #:initial-pattern ip             (or #:initpat ip)
+                          #:maximum-iterations mi          (or #:maxiter mi)
+                          #:complexity-penalty cp          (or #:cpxpnlt cp)
+                          #:conjunction-expansion ce       (or #:cnjexp ce)
+                          #:enforce-specialization es      (or #:enfspec es)
+                          #:maximum-conjuncts mc           (or #:maxcnj mc)
+                          #:maximum-variables mv           (or #:maxvar mv)
+                          #:maximum-spcial-conjuncts mspc  (or #:maxspcjn mspc)
+                          #:maximum-cnjexp-variables mcev  (or #:maxcevar mcev)
+                          #:surprisingness su              (or #:surp su)
+                          #:db-ratio dbr
+                          #:bootstrap-tolerance bt
+                          #:maximum-resamples mr
+                          #:value-count-error vce
+                          #:maximum-partitions mp
+                          #:top-k tk
+                          #:maximum-time mt
+                          #:maximum-memory mm
+                          #:mode md
+                          #:checkpoint cf
+                          #:checkpoint-interval ci
+                          #:resume rs)
+
+  Arguments shared with cog-mine are as described in (help cog-mine),
+  with the following differences:
+
+  mi: Each iteration expands one pattern, in the order they are
+      found, by shallow specialization and conjunction expansion,
+      while an iteration of cog-mine applies one rule. Thus the same
+      mi does not yield the same patterns, unless it is negative, in
+      which case both exhaust the search space.
+
+  cp: Accepted for compatibility with cog-mine but has no effect, as
+      there is no forward chainer to control.
+
+  mc, mv, mcev: Not capped to 9.
+
+  su: [optional, default='none] Either 'none, 'isurp or 'nisurp, any
+      other value raises an error. If 'none the result is a (scheme)
+      list of patterns, initial pattern included. Otherwise it is a
+      list of surprisingness evaluations of the patterns with more
+      than one conjunct, sorted by decreasing surprisingness. Patterns
+      are then scored by jb threads while mining goes on, instead of
+      once mining is over. tk, if positive, only keeps the tk most
+      surprising ones but, unlike with cog-mine, all patterns are
+      fully scored.
+
+  The following arguments are specific to cog-mine-native.
+
+  mt: [optional, default=-1] Wall-clock time in seconds allocated to
+      mining. If negative then no time limit.
+
+  mm: [optional, default=0] Resident memory in megabytes allocated to
+      the process. If 0 then no memory limit.
+
+  Once mt or mm is exceeded mining stops and the patterns found so far
+  are returned (and scored, if su is not 'none).
+
+  md: [optional, default='all] Which frequent patterns to return,
+      'all, 'closed (no specialization with the same support) or
+      'maximal (no specialization with enough support), any other
+      value raises an error. Patterns that cannot be closed or maximal
+      are pruned during the search, and returned patterns have their
+      exact supports memoized rather than supports up to ms.
+      Checkpointing is disabled for 'closed and 'maximal.
+
+  cf: [optional, default=#f] File name to checkpoint the patterns
+      found so far, their supports and the frontier of the search to,
+      every ci iterations (default=10) and at the end of the search.
+      If #f then no checkpoint is saved.
+
+  rs: [optional, default=#f] Flag whether to resume from the
+      checkpoint in cf, if any. The checkpoint is ignored if it has
+      been saved with a different minimum support, initial pattern or
+      db size.
+"
+  (define (diff? x y) (not (equal? x y)))
+  (define (num-diff? x y) (not (= (to-number x) (to-number y))))
+
+  ;; Set mininum frequency
+  (define mf
+    (to-number
+     (cond ((num-diff? minimum-frequency default-minimum-frequency) minimum-frequency)
+           ((num-diff? minfreq default-minimum-frequency) minfreq)
+           (else default-minimum-frequency))))
+
+  ;; Set minimum support
+  (define (get-minimum-support db-size)
+    (if (<= 0 mf)
+        (ceiling (* mf db-size))
+        (to-number
+         (cond ((num-diff? minimum-support default-minimum-support) minimum-support)
+               ((num-diff? minsup default-minimum-support) minsup)
+               (else default-minimum-support)))))
+
+  ;; Set initial pattern, adding a default variable declaration if
+  ;; missing, as the native miner requires one
+  (define ip
+    (let* ((ip (cond ((diff? initial-pattern default-initial-pattern) initial-pattern)
+                     ((diff? initpat default-initial-pattern) initpat)
+                     (else default-initial-pattern))))
+      (if (< 1 (cog-arity ip))
+          ip
+          (let* ((body (cog-outgoing-atom ip 0)))
+            (Lambda (VariableSet (cog-free-variables body)) body)))))
+
+  ;; Set maximum iterations
+  (define mi
+    (to-number
+     (cond ((num-diff? maximum-iterations default-maximum-iterations) maximum-iterations)
+           ((num-diff? maxiter default-maximum-iterations) maxiter)
+           (else default-maximum-iterations))))
+
+  ;; Set conjunction expansion
+  (define ce
+    (cond ((diff? conjunction-expansion default-conjunction-expansion) conjunction-expansion)
+          ((diff? cnjexp default-conjunction-expansion) cnjexp)
+          (else default-conjunction-expansion)))
+
+  ;; Set enforce specialization
+  (define es
+    (cond ((diff? enforce-specialization default-enforce-specialization) enforce-specialization)
+          ((diff? enfspec default-enforce-specialization) enfspec)
+          (else default-enforce-specialization)))
+
+  ;; Set maximum conjunctions
+  (define mc
+    (cond ((diff? maximum-conjuncts default-maximum-conjuncts) maximum-conjuncts)
+          ((diff? max-conjuncts default-maximum-conjuncts) max-conjuncts)
+          ((diff? maxcnj default-maximum-conjuncts) maxcnj)
+          (else default-maximum-conjuncts)))
+
+  ;; Set maximum variables
+  (define mv
+    (cond ((diff? maximum-variables default-maximum-variables) maximum-variables)
+          ((diff? max-variables default-maximum-variables) max-variables)
+          ((diff? maxvar default-maximum-variables) maxvar)
+          (else default-maximum-variables)))
+
+  ;; Set maximum number of conjuncts specialization can be applied to
+  (define mspc
+    (cond ((diff? maximum-spcial-conjuncts default-maximum-spcial-conjuncts) maximum-spcial-conjuncts)
+          ((diff? max-spcial-conjuncts default-maximum-spcial-conjuncts) max-spcial-conjuncts)
+          ((diff? maxspcjn default-maximum-spcial-conjuncts) maxspcjn)
+          (else default-maximum-spcial-conjuncts)))
+
+  ;; Set maximum variables in conjunction expansion
+  (define mcev
+    (cond ((diff? maximum-cnjexp-variables default-maximum-cnjexp-variables) maximum-cnjexp-variables)
+          ((diff? max-cnjexp-variables default-maximum-cnjexp-variables) max-cnjexp-variables)
+          ((diff? maxcevar default-maximum-cnjexp-variables) maxcevar)
+          (else default-maximum-cnjexp-variables)))
+
+  ;; Set surprisingness
+  (define su
+    (cond ((diff? surprisingness 'none) surprisingness)
+          ((diff? surp 'none) surp)
+          (else 'none)))
+
+  (if (not (memq su '(none isurp nisurp)))
+      (error "cog-mine-native: surprisingness must be 'none, 'isurp or 'nisurp, got" su))
+  (if (not (memq mode '(all closed maximal)))
+      (error "cog-mine-native: mode must be 'all, 'closed or 'maximal, got" mode))
+
+  (let* (;; Create a temporary child atomspace for the db concept
+         (tmp-as (cog-new-atomspace (cog-atomspace)))
+         (parent-as (cog-set-atomspace! tmp-as))
+         (db-concept? (and (cog-atom? db)
+                           (eq? (cog-type db) 'ConceptNode)))
+         (db-cpt (if db-concept? db (fill-db-cpt (random-db-cpt) db)))
+         (db-size (get-cardinality db-cpt))
+         (ms-n (to-number-node (get-minimum-support db-size)))
+         (bool->number (lambda (b) (if b 1 0)))
+         (params (List (to-number-node mi)
+                       (to-number-node mc)
+                       (to-number-node mv)
+                       (to-number-node mspc)
+                       (to-number-node mcev)
+                       (Number (bool->number ce))
+                       (Number (bool->number es))
+                       (to-number-node maximum-time)
+                       (Number (* (to-number maximum-memory) 1048576))
+                       (Number (bool->number (equal? mode 'closed)))
+                       (Number (bool->number (equal? mode 'maximal)))
+                       (if checkpoint (Concept checkpoint) '())
+                       (if checkpoint (Number checkpoint-interval) '())
+                       (if checkpoint (Number (bool->number resume)) '())))
+         (dbr-n (to-number-node db-ratio))
+         (results (with-surprisingness-settings
+                   (list jobs bootstrap-tolerance maximum-resamples
+                         value-count-error maximum-partitions)
+                   (lambda ()
+                     (cond ((equal? su 'isurp)
+                            (cog-native-mine-isurp db-cpt ms-n ip params dbr-n))
+                           ((equal? su 'nisurp)
+                            (cog-native-mine-nisurp db-cpt ms-n ip params dbr-n))
+                           (else (cog-native-mine db-cpt ms-n ip params))))))
+         (results-lst (if (equal? su 'none)
+                          (cog-outgoing-set results)
+                          (take-at-most top-k
+                            (desc-sort-by-tv-strength (cog-outgoing-set results)))))
+         ;; Copy the results to the parent atomspace
+         (parent-results-lst (cog-cp parent-as results-lst)))
+    (cog-set-atomspace! parent-as)
+    parent-results-lst))
+
 ;;;;;;;;;;;;;;;;;;
 ;; Miner Logger ;;
 ;;;;;;;;;;;;;;;;;;
@@ -1166,6 +1601,8 @@
     configure-optional-rules
     configure-rules
     configure-surprisingness
+    run-surprisingness
+    with-surprisingness-settings
     surp-target
     surp-vardecl
     configure-miner
@@ -1179,6 +1616,7 @@
     cog-miner-logger
     cog-miner
     cog-mine
+    cog-mine-native
     ;; Functions to allow the rules to run
     shallow-specialization-mv-1-formula
     shallow-specialization-mv-2-formula